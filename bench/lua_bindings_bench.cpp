@@ -0,0 +1,621 @@
+// Microbenchmarks for lua_bindings.hpp.
+// Writes one JSON array of results to stdout, progress goes to stderr:
+//   lua_bindings_bench [--filter substring] > results.json
+
+#include <lua.hpp>
+
+// Table accesses made by the decoders, counted through the macros below
+static size_t g_nextCount = 0;
+static size_t g_rawgetiCount = 0;
+
+static int countedNext(lua_State* L, int index) {
+    ++g_nextCount;
+    return lua_next(L, index);
+}
+
+static int countedRawgeti(lua_State* L, int index, lua_Integer i) {
+    ++g_rawgetiCount;
+    return lua_rawgeti(L, index, i);
+}
+
+#define lua_next countedNext
+#define lua_rawgeti countedRawgeti
+
+#include "lua_bindings.hpp"
+#include "lua_state_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+// Every operator new in the process is counted. The whole replaceable set
+// is defined, so each form of new pairs with a delete that frees the same
+// way (malloc and aligned_alloc memory both go to free).
+static std::atomic<size_t> g_newCount{0};
+
+static void* countedAlloc(size_t size, size_t alignment) noexcept {
+    g_newCount.fetch_add(1, std::memory_order_relaxed);
+    size = size ? size : 1;
+    if (alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+        return std::malloc(size);
+    }
+    return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
+
+static void* countedAllocOrThrow(size_t size, size_t alignment) {
+    if (void* p = countedAlloc(size, alignment)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new(size_t size) { return countedAllocOrThrow(size, 0); }
+void* operator new[](size_t size) { return countedAllocOrThrow(size, 0); }
+void* operator new(size_t size, std::align_val_t al) { return countedAllocOrThrow(size, static_cast<size_t>(al)); }
+void* operator new[](size_t size, std::align_val_t al) { return countedAllocOrThrow(size, static_cast<size_t>(al)); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return countedAlloc(size, 0); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return countedAlloc(size, 0); }
+void* operator new(size_t size, std::align_val_t al, const std::nothrow_t&) noexcept { return countedAlloc(size, static_cast<size_t>(al)); }
+void* operator new[](size_t size, std::align_val_t al, const std::nothrow_t&) noexcept { return countedAlloc(size, static_cast<size_t>(al)); }
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { std::free(p); }
+
+namespace {
+
+// lua_Alloc counting every allocation and reallocation of a state
+size_t g_luaAllocCount = 0;
+
+void* countingAlloc(void*, void* ptr, size_t, size_t nsize) {
+    if (nsize == 0) {
+        std::free(ptr);
+        return nullptr;
+    }
+    ++g_luaAllocCount;
+    return std::realloc(ptr, nsize);
+}
+
+struct Result {
+    std::string group;
+    std::string name;
+    size_t size;
+    double nsPerOp;
+    double luaAllocsPerOp;
+    double newAllocsPerOp;
+    double nextPerOp;
+    double rawgetiPerOp;
+};
+
+std::vector<Result> g_results;
+std::string g_filter;
+
+using Clock = std::chrono::steady_clock;
+
+// Calibrate the iteration count to ~20ms, then report the median of 5 runs
+template<typename Fn>
+void bench(const std::string& group, const std::string& name, size_t size, Fn&& fn) {
+    std::string fullName = group + "/" + name + "/" + std::to_string(size);
+    if (!g_filter.empty() && fullName.find(g_filter) == std::string::npos) {
+        return;
+    }
+
+    size_t iterations = 1;
+    while (true) {
+        auto start = Clock::now();
+        for (size_t i = 0; i < iterations; ++i) {
+            fn();
+        }
+        if (Clock::now() - start >= std::chrono::milliseconds(20) || iterations >= (size_t(1) << 30)) {
+            break;
+        }
+        iterations *= 2;
+    }
+
+    std::vector<double> samples;
+    size_t luaAllocs = 0;
+    size_t newAllocs = 0;
+    size_t nextCalls = 0;
+    size_t rawgetiCalls = 0;
+    for (int run = 0; run < 5; ++run) {
+        size_t luaBefore = g_luaAllocCount;
+        size_t newBefore = g_newCount.load(std::memory_order_relaxed);
+        size_t nextBefore = g_nextCount;
+        size_t rawgetiBefore = g_rawgetiCount;
+        auto start = Clock::now();
+        for (size_t i = 0; i < iterations; ++i) {
+            fn();
+        }
+        auto elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+        samples.push_back(elapsed / iterations);
+        luaAllocs += g_luaAllocCount - luaBefore;
+        newAllocs += g_newCount.load(std::memory_order_relaxed) - newBefore;
+        nextCalls += g_nextCount - nextBefore;
+        rawgetiCalls += g_rawgetiCount - rawgetiBefore;
+    }
+    std::sort(samples.begin(), samples.end());
+
+    double totalOps = 5.0 * iterations;
+    Result result{group, name, size, samples[2], luaAllocs / totalOps, newAllocs / totalOps, nextCalls / totalOps, rawgetiCalls / totalOps};
+    g_results.push_back(result);
+    std::fprintf(stderr, "%-50s %12.1f ns/op %8.2f lua allocs %8.2f new", fullName.c_str(), result.nsPerOp, result.luaAllocsPerOp, result.newAllocsPerOp);
+    if (result.nextPerOp > 0) {
+        // Passes over the table: a lua_next traversal or a lua_rawgeti sweep each count as one
+        std::fprintf(stderr, " %10.0f lua_next %10.0f lua_rawgeti %5.2f passes", result.nextPerOp, result.rawgetiPerOp, (result.nextPerOp + result.rawgetiPerOp) / size);
+    }
+    std::fprintf(stderr, "\n");
+}
+
+void writeJson() {
+    std::printf("[\n");
+    for (size_t i = 0; i < g_results.size(); ++i) {
+        const Result& r = g_results[i];
+        std::printf("  {\"group\": \"%s\", \"name\": \"%s\", \"size\": %zu, \"ns_per_op\": %.2f, \"lua_allocs_per_op\": %.3f, \"new_allocs_per_op\": %.3f, \"lua_next_per_op\": %.1f, \"lua_rawgeti_per_op\": %.1f}%s\n",
+            r.group.c_str(), r.name.c_str(), r.size, r.nsPerOp, r.luaAllocsPerOp, r.newAllocsPerOp, r.nextPerOp, r.rawgetiPerOp, i + 1 < g_results.size() ? "," : "");
+    }
+    std::printf("]\n");
+}
+
+const char* kScript = R"(
+    values = {
+        int = 42, float = 3.5, bool = true, str = "hello world", nilvalue = nil,
+        map = {a = 1, b = "two", c = true, d = 4.5}, intlist = {1, 2, 3, 4, 5, 6, 7, 8},
+    }
+    lists, maps = {}, {}
+
+    function make_tables(n)
+        local list, map = {}, {}
+        for i = 1, n do
+            list[i] = i
+            map["key" .. i] = i
+        end
+        lists[n], maps[n] = list, map
+    end
+
+    function sink(...) end
+    function count(...) return select('#', ...) end
+    function two(...) return 1, 2 end
+    function scalars() return 1, 2.5, 3, 4.5, 5, 6.5, 7, 8.5 end
+    function get_list(n) return lists[n] end
+    function get_map(n) return maps[n] end
+    function echo(x) return x end
+
+    function work(n)
+        local acc = 0
+        for i = 1, n do acc = acc + i % 7 end
+        return acc
+    end
+)";
+
+lua_State* newState() {
+    lua_State* L = lua_newstate(countingAlloc, nullptr);
+    luaL_openlibs(L);
+    if (luaL_dostring(L, kScript) != LUA_OK) {
+        std::fprintf(stderr, "%s\n", lua_tostring(L, -1));
+        std::exit(1);
+    }
+    return L;
+}
+
+// Leaves values.<field> on the stack
+void pushValue(lua_State* L, const char* field) {
+    lua_getglobal(L, "values");
+    lua_getfield(L, -1, field);
+    lua_remove(L, -2);
+}
+
+template<typename T>
+void benchRead(lua_State* L, const char* name, const char* field) {
+    pushValue(L, field);
+    bench("read", name, 1, [L] {
+        T value = LuaFunctionCaller::readFromLuaStack<T>(L, "bench", -1);
+        (void)value;
+    });
+    lua_pop(L, 1);
+}
+
+template<typename T>
+void benchPush(lua_State* L, const char* name, const T& value) {
+    bench("push", name, 1, [L, &value] {
+        LuaFunctionCaller::pushToLuaStack(L, value);
+        lua_pop(L, 1);
+    });
+}
+
+void benchBranches(lua_State* L) {
+    benchRead<lua_Integer>(L, "lua_Integer", "int");
+    benchRead<int>(L, "int", "int");
+    benchRead<double>(L, "double", "float");
+    benchRead<bool>(L, "bool", "bool");
+    benchRead<std::string>(L, "std::string", "str");
+    benchRead<BasicLuaType>(L, "BasicLuaType/int", "int");
+    benchRead<BasicLuaType>(L, "BasicLuaType/string", "str");
+    benchRead<String<32>>(L, "String<32>", "str");
+    benchRead<std::pair<String<8>, bool>>(L, "String<8>+overflow", "str");
+    benchRead<std::pair<std::array<int, 16>, size_t>>(L, "array-size pair", "intlist");
+    benchRead<std::vector<int>>(L, "vector<int>", "intlist");
+    benchRead<std::vector<BasicLuaType>>(L, "vector<BasicLuaType>", "intlist");
+    benchRead<std::unordered_map<std::string, BasicLuaType>>(L, "unordered_map<string,BasicLuaType>", "map");
+    benchRead<std::optional<int>>(L, "optional<int>/value", "int");
+    benchRead<std::optional<int>>(L, "optional<int>/nil", "nilvalue");
+
+    benchPush(L, "lua_Integer", lua_Integer(42));
+    benchPush(L, "double", 3.5);
+    benchPush(L, "bool", true);
+    benchPush(L, "std::string", std::string("hello world"));
+    benchPush(L, "BasicLuaType", BasicLuaType(std::string("hello world")));
+    benchPush(L, "String<32>", String<32>{'h', 'i'});
+    benchPush(L, "array-size pair", std::pair<std::array<int, 16>, size_t>{{1, 2, 3, 4, 5, 6, 7, 8}, 8});
+    benchPush(L, "vector<int>", std::vector<int>{1, 2, 3, 4, 5, 6, 7, 8});
+    benchPush(L, "unordered_map<string,int>", std::unordered_map<std::string, int>{{"a", 1}, {"b", 2}, {"c", 3}});
+    benchPush(L, "optional<int>", std::optional<int>(42));
+}
+
+template<size_t... I>
+void benchArity(lua_State* L, LuaFunctionRef& countRef, std::index_sequence<I...>) {
+    constexpr size_t arity = sizeof...(I);
+    bench("call", "callVoid", arity, [L] {
+        CallLuaFunction<void>(L, "sink", static_cast<lua_Integer>(I)...);
+    });
+    bench("call", "call", arity, [L] {
+        int n = CallLuaFunction<int>(L, "count", static_cast<lua_Integer>(I)...);
+        (void)n;
+    });
+    bench("call", "callMultiReturn", arity, [L] {
+        auto result = CallLuaFunction<int, int>(L, "two", static_cast<lua_Integer>(I)...);
+        (void)result;
+    });
+    bench("call", "call/LuaFunctionRef", arity, [&countRef] {
+        int n = CallLuaFunction<int>(countRef, static_cast<lua_Integer>(I)...);
+        (void)n;
+    });
+}
+
+template<size_t... N>
+void benchCallPaths(lua_State* L, std::index_sequence<N...>) {
+    LuaFunctionRef countRef(L, "count");
+    (benchArity(L, countRef, std::make_index_sequence<N>{}), ...);
+}
+
+// The table decoders before single-pass decoding, kept as the baseline.
+// Lists: an isList traversal with lua_len, then a lua_rawgeti sweep.
+bool legacyIsList(lua_State* L, int index) {
+    index = lua_absindex(L, index);
+    if (!lua_istable(L, index)) {
+        return false;
+    }
+    lua_len(L, index);
+    lua_Integer tableLength = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    if (tableLength == 0) {
+        return true;
+    }
+    lua_Integer maxKey = 0;
+    lua_pushnil(L);
+    while (lua_next(L, index)) {
+        if (!lua_isinteger(L, -2) || lua_tointeger(L, -2) < 1) {
+            lua_pop(L, 2);
+            return false;
+        }
+        maxKey = std::max(maxKey, lua_tointeger(L, -2));
+        lua_pop(L, 1);
+    }
+    return maxKey == tableLength;
+}
+
+template<typename T>
+std::vector<T> legacyReadVector(lua_State* L, int index) {
+    if (!legacyIsList(L, index)) {
+        throw std::runtime_error("Unexpected non-list type in legacyReadVector");
+    }
+    std::vector<T> result;
+    int len = static_cast<int>(lua_rawlen(L, index));
+    result.reserve(len);
+    for (int i = 1; i <= len; ++i) {
+        lua_rawgeti(L, index, i);
+        result.push_back(LuaFunctionCaller::readFromLuaStack<T>(L, "bench", -1));
+        lua_pop(L, 1);
+    }
+    return result;
+}
+
+// Maps: an isDict traversal, a counting traversal, then the reading one
+// with the key and value type probes it discarded
+template<typename Key, typename Value>
+std::unordered_map<Key, Value> legacyReadMap(lua_State* L, int index) {
+    int tableIndex = lua_absindex(L, index);
+    if (!lua_istable(L, tableIndex)) {
+        throw std::runtime_error("Unexpected non-dict type in legacyReadMap");
+    }
+    lua_pushnil(L);
+    while (lua_next(L, tableIndex)) {
+        if (lua_type(L, -2) == LUA_TNIL) {
+            lua_pop(L, 2);
+            throw std::runtime_error("Unexpected non-dict type in legacyReadMap");
+        }
+        lua_pop(L, 1);
+    }
+    size_t count = 0;
+    lua_pushnil(L);
+    while (lua_next(L, tableIndex)) {
+        count += lua_type(L, -1) != LUA_TNIL ? 1 : 0;
+        lua_pop(L, 1);
+    }
+    std::unordered_map<Key, Value> result;
+    result.reserve(count);
+    lua_pushnil(L);
+    while (lua_next(L, tableIndex)) {
+        lua_get_type(keyType, L, -2);
+        lua_get_type(valueType, L, -1);
+        (void)keyType;
+        (void)valueType;
+        result[LuaFunctionCaller::readFromLuaStack<Key>(L, "bench", -2)] = LuaFunctionCaller::readFromLuaStack<Value>(L, "bench", -1);
+        lua_pop(L, 1);
+    }
+    return result;
+}
+
+void benchTableSizes(lua_State* L) {
+    for (size_t n = 10; n <= 1000000; n *= 10) {
+        CallLuaFunction<void>(L, "make_tables", n);
+
+        lua_getglobal(L, "lists");
+        lua_rawgeti(L, -1, static_cast<lua_Integer>(n));
+        bench("table", "legacy read vector<lua_Integer>", n, [L] {
+            auto list = legacyReadVector<lua_Integer>(L, -1);
+            (void)list;
+        });
+        bench("table", "read vector<lua_Integer>", n, [L] {
+            auto list = LuaFunctionCaller::readFromLuaStack<std::vector<lua_Integer>>(L, "bench", -1);
+            (void)list;
+        });
+        lua_pop(L, 2);
+
+        lua_getglobal(L, "maps");
+        lua_rawgeti(L, -1, static_cast<lua_Integer>(n));
+        bench("table", "legacy read unordered_map<string,lua_Integer>", n, [L] {
+            auto map = legacyReadMap<std::string, lua_Integer>(L, -1);
+            (void)map;
+        });
+        bench("table", "read unordered_map<string,lua_Integer>", n, [L] {
+            auto map = LuaFunctionCaller::readFromLuaStack<std::unordered_map<std::string, lua_Integer>>(L, "bench", -1);
+            (void)map;
+        });
+        lua_pop(L, 2);
+
+        std::vector<lua_Integer> list(n, 7);
+        bench("table", "push vector<lua_Integer>", n, [L, &list] {
+            LuaFunctionCaller::pushToLuaStack(L, list);
+            lua_pop(L, 1);
+        });
+
+        bench("table", "call get_list", n, [L, n] {
+            auto result = CallLuaFunction<std::vector<lua_Integer>>(L, "get_list", n);
+            (void)result;
+        });
+    }
+}
+
+// The decoders before conversion plans, copied as the baseline. Scalars:
+// lua_get_type, then a separate conversion call.
+template<typename T>
+T legacyReadScalar(lua_State* L, int index) {
+    lua_get_type(type, L, index);
+    if constexpr (std::is_integral_v<T>) {
+        switch (type) {
+            case LUA_TNIL:
+                throw std::runtime_error("Unexpected nil, expected an integer");
+            case LUA_TINTEGER:
+                return static_cast<T>(lua_tointeger(L, index));
+            case LUA_TNUMBER:
+                return static_cast<T>(lua_tonumber(L, index));
+            case LUA_TBOOLEAN:
+                return static_cast<T>(lua_toboolean(L, index));
+            case LUA_TSTRING:
+                throw std::runtime_error("Unexpected string, expected an integer");
+            default:
+                throw std::runtime_error("Unexpected non-BasicLuaType type, expected an integer");
+        }
+    } else {
+        switch (type) {
+            case LUA_TNIL:
+                throw std::runtime_error("Unexpected nil, expected a float");
+            case LUA_TINTEGER:
+                return static_cast<T>(lua_tointeger(L, index));
+            case LUA_TNUMBER:
+                return static_cast<T>(lua_tonumber(L, index));
+            case LUA_TBOOLEAN:
+                throw std::runtime_error("Unexpected bool, expected a float");
+            case LUA_TSTRING:
+                throw std::runtime_error("Unexpected string, expected a float");
+            default:
+                throw std::runtime_error("Unexpected non-BasicLuaType, expected a float");
+        }
+    }
+}
+
+// Container elements: numbers took a lua_type check and lua_tointegerx or
+// lua_tonumber, anything else the generic scalar path
+template<typename T>
+T legacyReadElement(lua_State* L, int index) {
+    if (lua_type(L, index) == LUA_TNUMBER) {
+        if constexpr (std::is_integral_v<T>) {
+            int isint;
+            lua_Integer value = lua_tointegerx(L, index, &isint);
+            return isint ? static_cast<T>(value) : static_cast<T>(lua_tonumber(L, index));
+        } else {
+            return static_cast<T>(lua_tonumber(L, index));
+        }
+    }
+    return legacyReadScalar<T>(L, index);
+}
+
+// The single-pass list traversal, unchanged since
+template<typename Store>
+lua_Integer legacyDecodeList(lua_State* L, int index, Store&& store) {
+    index = lua_absindex(L, index);
+    if (!lua_istable(L, index)) {
+        throw std::runtime_error("Unexpected non-list type, expected a list");
+    }
+    lua_Integer tableLength = static_cast<lua_Integer>(lua_rawlen(L, index));
+    if (tableLength == 0) {
+        return 0;
+    }
+    lua_Integer maxKey = 0;
+    lua_Integer count = 0;
+    lua_pushnil(L);
+    while (lua_next(L, index)) {
+        if (!lua_isinteger(L, -2) || lua_tointeger(L, -2) < 1 || lua_tointeger(L, -2) > tableLength) {
+            lua_pop(L, 2);
+            throw std::runtime_error("Unexpected non-list type, expected a list");
+        }
+        lua_Integer key = lua_tointeger(L, -2);
+        try {
+            store(key);
+        } catch (...) {
+            lua_pop(L, 2);
+            throw;
+        }
+        maxKey = std::max(maxKey, key);
+        ++count;
+        lua_pop(L, 1);
+    }
+    if (maxKey != tableLength) {
+        throw std::runtime_error("Unexpected non-list type, expected a list");
+    }
+    if (count != maxKey) {
+        for (lua_Integer i = 1; i <= maxKey; ++i) {
+            if (lua_rawgeti(L, index, i) == LUA_TNIL) {
+                try {
+                    store(i);
+                } catch (...) {
+                    lua_pop(L, 1);
+                    throw;
+                }
+            }
+            lua_pop(L, 1);
+        }
+    }
+    return maxKey;
+}
+
+// Sequences: reserve, then grow by emplace_back per element
+template<typename T>
+std::vector<T> legacyReadList(lua_State* L, int index) {
+    std::vector<T> out;
+    if (lua_istable(L, index)) {
+        out.reserve(lua_rawlen(L, index));
+    }
+    lua_Integer len = legacyDecodeList(L, index, [&](lua_Integer key) {
+        size_t position = static_cast<size_t>(key - 1);
+        if (position == out.size()) {
+            out.emplace_back();
+        } else if (position > out.size()) {
+            out.resize(position + 1);
+        }
+        out[position] = legacyReadElement<T>(L, -1);
+    });
+    out.resize(static_cast<size_t>(len));
+    return out;
+}
+
+void benchPlans(lua_State* L) {
+    if (luaL_dostring(L, "return 1, 2.5, 3, 4.5, 5, 6.5, 7, 8.5") != LUA_OK) {
+        std::exit(1);
+    }
+    bench("plan", "legacy 8 scalars", 8, [L] {
+        lua_Integer i = 0;
+        double d = 0;
+        for (int k = -8; k < 0; k += 2) {
+            i += legacyReadScalar<lua_Integer>(L, k);
+            d += legacyReadScalar<double>(L, k + 1);
+        }
+        (void)i;
+        (void)d;
+    });
+    bench("plan", "planned 8 scalars", 8, [L] {
+        lua_Integer i = 0;
+        double d = 0;
+        for (int k = -8; k < 0; k += 2) {
+            i += LuaFunctionCaller::readFromLuaStack<lua_Integer>(L, "bench", k);
+            d += LuaFunctionCaller::readFromLuaStack<double>(L, "bench", k + 1);
+        }
+        (void)i;
+        (void)d;
+    });
+    lua_pop(L, 8);
+
+    bench("plan", "call 8 scalar results", 8, [L] {
+        auto result = CallLuaFunction<int, double, int, double, int, double, int, double>(L, "scalars");
+        (void)result;
+    });
+
+    for (size_t n = 10; n <= 100000; n *= 100) {
+        CallLuaFunction<void>(L, "make_tables", n);
+        lua_getglobal(L, "lists");
+        lua_rawgeti(L, -1, static_cast<lua_Integer>(n));
+        bench("plan", "legacy vector<double>", n, [L] {
+            auto list = legacyReadList<double>(L, -1);
+            (void)list;
+        });
+        bench("plan", "planned vector<double>", n, [L] {
+            auto list = LuaFunctionCaller::readFromLuaStack<std::vector<double>>(L, "bench", -1);
+            (void)list;
+        });
+        lua_pop(L, 2);
+    }
+}
+
+void benchPoolScaling() {
+    constexpr size_t tasks = 4096;
+    for (size_t threads = 1; threads <= 64; threads *= 2) {
+        LuaStatePool pool(threads, kScript);
+        bench("pool", "submit work(200)", threads, [&pool] {
+            std::vector<std::future<lua_Integer>> results;
+            results.reserve(tasks);
+            for (size_t i = 0; i < tasks; ++i) {
+                results.push_back(pool.submit<lua_Integer>("work", 200));
+            }
+            for (auto& result : results) {
+                result.get();
+            }
+        });
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--filter" && i + 1 < argc) {
+            g_filter = argv[++i];
+        }
+    }
+
+    lua_State* L = newState();
+    benchBranches(L);
+    benchCallPaths(L, std::index_sequence<0, 1, 2, 3, 4, 5, 6, 7, 8>{});
+    benchTableSizes(L);
+    benchPlans(L);
+    lua_close(L);
+
+    benchPoolScaling();
+
+    writeJson();
+    return 0;
+}
@@ -0,0 +1,425 @@
+#ifndef LUA_LUAALLOCATOR
+#define LUA_LUAALLOCATOR
+
+#include <lua.hpp>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+struct LuaMemoryStats {
+    size_t liveBytes = 0;
+    size_t peakBytes = 0;
+    size_t allocations = 0;
+    size_t frees = 0;
+    size_t arenaAllocations = 0;
+};
+
+// Size-class pool allocator for one lua_State, installed with lua_newstate.
+// Blocks up to kMaxSmall bytes come from 64 KiB chunks with a free list per
+// 16-byte class; larger blocks go to malloc. Lua always passes the old block
+// size, so blocks carry no per-allocation header.
+//
+// Inside an arena scope (LuaArenaScope) small blocks are bump-allocated from
+// arena chunks instead. A chunk is recycled once every block in it has been
+// freed by the collector, so objects that outlive the scope stay valid.
+//
+// One allocator belongs to one state and is only called from the thread
+// running that state; stats() may be read from any thread.
+class LuaPoolAllocator {
+public:
+    static constexpr size_t kChunkSize = 64 * 1024;
+    static constexpr size_t kGranularity = 16;
+    static constexpr size_t kMaxSmall = 512;
+
+    LuaPoolAllocator() = default;
+    LuaPoolAllocator(const LuaPoolAllocator&) = delete;
+    LuaPoolAllocator& operator=(const LuaPoolAllocator&) = delete;
+
+    ~LuaPoolAllocator() {
+        for (void* chunk : chunks_) {
+            std::free(chunk);
+        }
+    }
+
+    // lua_Alloc entry point, ud is the LuaPoolAllocator
+    static void* alloc(void* ud, void* ptr, size_t osize, size_t nsize) {
+        auto* self = static_cast<LuaPoolAllocator*>(ud);
+        if (nsize == 0) {
+            if (ptr) {
+                self->release(ptr, osize);
+                self->recordFree(osize);
+            }
+            return nullptr;
+        }
+        if (!ptr) {
+            void* block = self->allocate(nsize);
+            if (block) {
+                self->recordAllocation(nsize);
+            }
+            return block;
+        }
+        void* block = self->reallocate(ptr, osize, nsize);
+        if (block) {
+            self->recordResize(osize, nsize);
+        }
+        return block;
+    }
+
+    LuaMemoryStats stats() const {
+        LuaMemoryStats result;
+        result.liveBytes = liveBytes_.load(std::memory_order_relaxed);
+        result.peakBytes = peakBytes_.load(std::memory_order_relaxed);
+        result.allocations = allocations_.load(std::memory_order_relaxed);
+        result.frees = frees_.load(std::memory_order_relaxed);
+        result.arenaAllocations = arenaAllocations_.load(std::memory_order_relaxed);
+        return result;
+    }
+
+    void resetPeak() {
+        peakBytes_.store(liveBytes_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+
+    // Arena scopes nest; small allocations use the arena while any is open
+    void beginArena() {
+        ++arenaDepth_;
+    }
+
+    void endArena() {
+        if (arenaDepth_ == 0 || --arenaDepth_ > 0) {
+            return;
+        }
+        if (arenaChunk_ && header(arenaChunk_)->live == 0) {
+            // Nothing escaped, keep the chunk for the next scope
+            arenaCursor_ = blocksBegin(arenaChunk_);
+        } else {
+            // Survivors keep the chunk alive, it is recycled by release()
+            arenaChunk_ = nullptr;
+        }
+    }
+
+private:
+    struct ChunkHeader {
+        size_t live;  // Outstanding arena blocks, unused for pool chunks
+        bool arena;
+    };
+
+    static constexpr size_t kHeaderSize = (sizeof(ChunkHeader) + kGranularity - 1) / kGranularity * kGranularity;
+    static constexpr size_t kClassCount = kMaxSmall / kGranularity;
+    static constexpr size_t kMaxSpareChunks = 8;
+
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    static size_t roundUp(size_t size) {
+        return (size + kGranularity - 1) / kGranularity * kGranularity;
+    }
+
+    static size_t classOf(size_t size) {
+        return (size - 1) / kGranularity;
+    }
+
+    static ChunkHeader* header(void* chunk) {
+        return static_cast<ChunkHeader*>(chunk);
+    }
+
+    static ChunkHeader* chunkOf(void* block) {
+        return reinterpret_cast<ChunkHeader*>(reinterpret_cast<uintptr_t>(block) & ~(uintptr_t(kChunkSize) - 1));
+    }
+
+    static char* blocksBegin(void* chunk) {
+        return static_cast<char*>(chunk) + kHeaderSize;
+    }
+
+    static char* blocksEnd(void* chunk) {
+        return static_cast<char*>(chunk) + kChunkSize;
+    }
+
+    void* newChunk(bool arena) {
+        void* chunk;
+        if (!spareChunks_.empty()) {
+            chunk = spareChunks_.back();
+            spareChunks_.pop_back();
+        } else {
+            chunk = std::aligned_alloc(kChunkSize, kChunkSize);
+            if (!chunk) {
+                return nullptr;
+            }
+            chunks_.push_back(chunk);
+        }
+        header(chunk)->live = 0;
+        header(chunk)->arena = arena;
+        return chunk;
+    }
+
+    void* allocate(size_t size) {
+        if (size > kMaxSmall) {
+            return std::malloc(size);
+        }
+        size_t rounded = roundUp(size);
+        return arenaDepth_ > 0 ? allocateArena(rounded) : allocatePool(rounded);
+    }
+
+    void* allocatePool(size_t rounded) {
+        FreeBlock*& head = freeLists_[classOf(rounded)];
+        if (head) {
+            FreeBlock* block = head;
+            head = block->next;
+            return block;
+        }
+        if (!poolChunk_ || poolCursor_ + rounded > blocksEnd(poolChunk_)) {
+            poolChunk_ = newChunk(false);
+            if (!poolChunk_) {
+                return nullptr;
+            }
+            poolCursor_ = blocksBegin(poolChunk_);
+        }
+        void* block = poolCursor_;
+        poolCursor_ += rounded;
+        return block;
+    }
+
+    void* allocateArena(size_t rounded) {
+        if (!arenaChunk_ || arenaCursor_ + rounded > blocksEnd(arenaChunk_)) {
+            if (arenaChunk_ && header(arenaChunk_)->live == 0) {
+                arenaCursor_ = blocksBegin(arenaChunk_);
+            } else {
+                arenaChunk_ = newChunk(true);
+                if (!arenaChunk_) {
+                    return nullptr;
+                }
+                arenaCursor_ = blocksBegin(arenaChunk_);
+            }
+        }
+        void* block = arenaCursor_;
+        arenaCursor_ += rounded;
+        ++header(arenaChunk_)->live;
+        arenaAllocations_.store(arenaAllocations_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return block;
+    }
+
+    void release(void* block, size_t size) {
+        if (size > kMaxSmall) {
+            std::free(block);
+            return;
+        }
+        ChunkHeader* chunk = chunkOf(block);
+        if (!chunk->arena) {
+            auto* freeBlock = static_cast<FreeBlock*>(block);
+            FreeBlock*& head = freeLists_[classOf(roundUp(size))];
+            freeBlock->next = head;
+            head = freeBlock;
+            return;
+        }
+        if (--chunk->live == 0 && chunk != arenaChunk_) {
+            recycle(chunk);
+        }
+    }
+
+    void recycle(void* chunk) {
+        if (spareChunks_.size() < kMaxSpareChunks) {
+            spareChunks_.push_back(chunk);
+            return;
+        }
+        std::erase(chunks_, chunk);
+        std::free(chunk);
+    }
+
+    void* reallocate(void* ptr, size_t osize, size_t nsize) {
+        if (osize > kMaxSmall && nsize > kMaxSmall) {
+            return std::realloc(ptr, nsize);
+        }
+        if (osize <= kMaxSmall && nsize <= kMaxSmall && roundUp(osize) == roundUp(nsize)) {
+            return ptr;
+        }
+        void* block = allocate(nsize);
+        if (!block) {
+            return nullptr;  // Lua keeps the old block
+        }
+        std::memcpy(block, ptr, osize < nsize ? osize : nsize);
+        release(ptr, osize);
+        return block;
+    }
+
+    // Single writer (the state's thread), relaxed loads from readers
+    void recordAllocation(size_t size) {
+        allocations_.store(allocations_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        addLive(size);
+    }
+
+    void recordFree(size_t size) {
+        frees_.store(frees_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        liveBytes_.store(liveBytes_.load(std::memory_order_relaxed) - size, std::memory_order_relaxed);
+    }
+
+    void recordResize(size_t osize, size_t nsize) {
+        if (nsize >= osize) {
+            addLive(nsize - osize);
+        } else {
+            liveBytes_.store(liveBytes_.load(std::memory_order_relaxed) - (osize - nsize), std::memory_order_relaxed);
+        }
+    }
+
+    void addLive(size_t size) {
+        size_t live = liveBytes_.load(std::memory_order_relaxed) + size;
+        liveBytes_.store(live, std::memory_order_relaxed);
+        if (live > peakBytes_.load(std::memory_order_relaxed)) {
+            peakBytes_.store(live, std::memory_order_relaxed);
+        }
+    }
+
+    FreeBlock* freeLists_[kClassCount] = {};
+    void* poolChunk_ = nullptr;
+    char* poolCursor_ = nullptr;
+    void* arenaChunk_ = nullptr;
+    char* arenaCursor_ = nullptr;
+    unsigned arenaDepth_ = 0;
+    std::vector<void*> chunks_;
+    std::vector<void*> spareChunks_;
+
+    std::atomic<size_t> liveBytes_{0};
+    std::atomic<size_t> peakBytes_{0};
+    std::atomic<size_t> allocations_{0};
+    std::atomic<size_t> frees_{0};
+    std::atomic<size_t> arenaAllocations_{0};
+};
+
+// Allocator of a state created by NewPooledLuaState, nullptr for other states
+inline LuaPoolAllocator* GetLuaPoolAllocator(lua_State* L) {
+    void* ud;
+    if (lua_getallocf(L, &ud) != &LuaPoolAllocator::alloc) {
+        return nullptr;
+    }
+    return static_cast<LuaPoolAllocator*>(ud);
+}
+
+// The panic and warning handlers luaL_newstate installs, for states created
+// with lua_newstate: a panic prints the error to stderr before Lua aborts,
+// and warnings go to stderr once a script turns them on with warn("@on").
+struct LuaDefaultHandlers {
+    static void install(lua_State* L) {
+        lua_atpanic(L, &panic);
+#if LUA_VERSION_NUM >= 504
+        lua_setwarnf(L, &warnOff, L);
+#endif
+    }
+
+    static int panic(lua_State* L) {
+        const char* message = lua_type(L, -1) == LUA_TSTRING ? lua_tostring(L, -1) : "error object is not a string";
+        std::fprintf(stderr, "PANIC: unprotected error in call to Lua API (%s)\n", message);
+        std::fflush(stderr);
+        return 0;
+    }
+
+#if LUA_VERSION_NUM >= 504
+    // "@on" and "@off" switch warnings, other messages starting with '@' are ignored
+    static bool control(lua_State* L, const char* message, int tocont) {
+        if (tocont || *message != '@') {
+            return false;
+        }
+        if (std::strcmp(message + 1, "off") == 0) {
+            lua_setwarnf(L, &warnOff, L);
+        } else if (std::strcmp(message + 1, "on") == 0) {
+            lua_setwarnf(L, &warnOn, L);
+        }
+        return true;
+    }
+
+    static void warnOff(void* ud, const char* message, int tocont) {
+        control(static_cast<lua_State*>(ud), message, tocont);
+    }
+
+    static void warnOn(void* ud, const char* message, int tocont) {
+        if (control(static_cast<lua_State*>(ud), message, tocont)) {
+            return;
+        }
+        std::fputs("Lua warning: ", stderr);
+        warnContinue(ud, message, tocont);
+    }
+
+    // A message split over several calls, tocont set on all but the last
+    static void warnContinue(void* ud, const char* message, int tocont) {
+        auto* L = static_cast<lua_State*>(ud);
+        std::fputs(message, stderr);
+        if (tocont) {
+            lua_setwarnf(L, &warnContinue, L);
+        } else {
+            std::fputs("\n", stderr);
+            std::fflush(stderr);
+            lua_setwarnf(L, &warnOn, L);
+        }
+    }
+#endif
+};
+
+// Create a lua_State backed by its own LuaPoolAllocator.
+// Close it with ClosePooledLuaState (or hold it in a LuaStatePtr).
+inline lua_State* NewPooledLuaState(bool openLibs = true) {
+    auto allocator = std::make_unique<LuaPoolAllocator>();
+    lua_State* L = lua_newstate(&LuaPoolAllocator::alloc, allocator.get());
+    if (!L) {
+        throw std::bad_alloc();
+    }
+    allocator.release();
+    LuaDefaultHandlers::install(L);
+    if (openLibs) {
+        luaL_openlibs(L);
+    }
+    return L;
+}
+
+// Closes any state; also frees the allocator of a pooled state
+inline void ClosePooledLuaState(lua_State* L) {
+    LuaPoolAllocator* allocator = GetLuaPoolAllocator(L);
+    lua_close(L);
+    delete allocator;
+}
+
+struct LuaStateCloser {
+    void operator()(lua_State* L) const {
+        ClosePooledLuaState(L);
+    }
+};
+
+using LuaStatePtr = std::unique_ptr<lua_State, LuaStateCloser>;
+
+// Memory stats of a pooled state
+inline LuaMemoryStats GetLuaMemoryStats(lua_State* L) {
+    LuaPoolAllocator* allocator = GetLuaPoolAllocator(L);
+    if (!allocator) {
+        throw std::runtime_error("lua_State was not created by NewPooledLuaState");
+    }
+    return allocator->stats();
+}
+
+// Routes small allocations of a pooled state to a monotonic arena for the
+// lifetime of the scope, e.g. around a call that marshals large temporary
+// tables. No-op for states without a LuaPoolAllocator.
+class LuaArenaScope {
+public:
+    explicit LuaArenaScope(lua_State* L) : allocator_(GetLuaPoolAllocator(L)) {
+        if (allocator_) {
+            allocator_->beginArena();
+        }
+    }
+
+    LuaArenaScope(const LuaArenaScope&) = delete;
+    LuaArenaScope& operator=(const LuaArenaScope&) = delete;
+
+    ~LuaArenaScope() {
+        if (allocator_) {
+            allocator_->endArena();
+        }
+    }
+
+private:
+    LuaPoolAllocator* allocator_;
+};
+
+#endif
@@ -0,0 +1,379 @@
+#ifndef LUA_LUAASYNC
+#define LUA_LUAASYNC
+
+#include "lua_bindings.hpp"
+#include "lua_cpp_function.hpp"
+#include <atomic>
+#include <coroutine>
+#include <exception>
+
+class LuaPromise;
+
+// Machinery behind CallLuaFunctionAsync and async C++ functions.
+//
+// Each async call runs the Lua function on its own thread (lua_newthread),
+// so any number of calls can be in flight on one state. When the script
+// calls an async C++ function, that function starts its operation and keeps
+// the LuaPromise it was given; the Lua thread then yields, and the awaiting
+// C++ coroutine stays suspended. Completing the promise, normally from the
+// event loop, resumes the Lua thread with the results (or raises the error
+// at the call site), and once the Lua function returns the C++ coroutine is
+// resumed in turn. A promise completed before its function returns makes
+// the call synchronous, without any yield.
+//
+// Everything runs on the thread that owns the lua_State: promises must be
+// completed there and before the state is closed. Async C++ functions may
+// only be called from the body of an async call, not from a plain
+// CallLuaFunction or from a coroutine created by the script.
+class LuaAsync {
+public:
+    // State of one async call, shared by its awaiter, the trampolines and
+    // the promises through a registry entry keyed by the Lua thread
+    class Call {
+    public:
+        Call(const Call&) = delete;
+        Call& operator=(const Call&) = delete;
+
+    protected:
+        Call() = default;
+
+        ~Call() {
+            detach();
+        }
+
+        // Create the thread and pin it; the caller pushes function and arguments
+        void attach(lua_State* L, std::string_view name) {
+            state_ = L;
+            name_ = name;
+            thread_ = lua_newthread(L);
+            threadRef_ = luaL_ref(L, LUA_REGISTRYINDEX);
+            lua_pushlightuserdata(L, this);
+            lua_rawsetp(L, LUA_REGISTRYINDEX, thread_);
+        }
+
+        void detach() {
+            if (thread_) {
+                lua_pushnil(state_);
+                lua_rawsetp(state_, LUA_REGISTRYINDEX, thread_);
+                luaL_unref(state_, LUA_REGISTRYINDEX, threadRef_);
+                thread_ = nullptr;
+            }
+        }
+
+        // Run the thread until it awaits a promise or finishes. Resuming the
+        // waiting coroutine is the last step, it may destroy this object.
+        void resume(int nargs) {
+            int results;
+#if LUA_VERSION_NUM >= 504
+            int status = lua_resume(thread_, state_, nargs, &results);
+#else
+            int status = lua_resume(thread_, state_, nargs);
+            results = lua_gettop(thread_);
+#endif
+            if (status == LUA_YIELD && awaiting_) {
+                return;
+            }
+            if (status == LUA_OK) {
+                try {
+                    settle(thread_, results);
+                } catch (...) {
+                    error_ = std::current_exception();
+                }
+            } else if (status == LUA_YIELD) {
+                error_ = std::make_exception_ptr(std::runtime_error(std::format("Function '{}' yielded outside an async C++ function", name_)));
+            } else {
+                const char* message = lua_tostring(thread_, -1);
+                error_ = std::make_exception_ptr(std::runtime_error(message ? message : "unknown error"));
+            }
+            done_ = true;
+            detach();
+            if (waiter_) {
+                std::exchange(waiter_, {}).resume();
+            }
+        }
+
+        // Decode the results on top of thread
+        virtual void settle(lua_State* thread, int results) = 0;
+
+        lua_State* state_ = nullptr;
+        lua_State* thread_ = nullptr;
+        int threadRef_ = LUA_NOREF;
+        std::string name_;
+        bool done_ = false;
+        std::exception_ptr error_;
+        std::coroutine_handle<> waiter_;
+
+    private:
+        friend class LuaAsync;
+        friend class LuaPromise;
+
+        uint64_t ticket_ = 0;      // Promise currently handed out
+        bool inFunction_ = false;  // An async C++ function is running
+        bool settled_ = false;     // Its promise was completed
+        bool rejected_ = false;    // ... with an error message
+        bool awaiting_ = false;    // The thread yielded for it
+    };
+
+    // Push an async C++ function: its first parameter is the LuaPromise to
+    // complete, the others are decoded from the Lua arguments
+    template<typename Callable>
+    static void push(lua_State* L, Callable&& callable) {
+        using F = std::decay_t<Callable>;
+        using Signature = LuaCppSignature<F>;
+        if constexpr (std::is_empty_v<F> && std::is_default_constructible_v<F>) {
+            lua_pushcfunction(L, (&trampoline<F, Signature>));
+        } else {
+            LuaCppFunction::store<F>(L, std::forward<Callable>(callable));
+            lua_pushcclosure(L, (&trampoline<F, Signature>), 1);
+        }
+    }
+
+private:
+    friend class LuaPromise;
+
+    static Call* find(lua_State* L, lua_State* thread) {
+        lua_rawgetp(L, LUA_REGISTRYINDEX, thread);
+        auto* call = static_cast<Call*>(lua_touserdata(L, -1));
+        lua_pop(L, 1);
+        return call;
+    }
+
+    static uint64_t nextTicket() {
+        static std::atomic<uint64_t> ticket{0};
+        return ticket.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+
+    template<typename F, typename Signature>
+    static int trampoline(lua_State* L) {
+        Call* call = find(L, L);
+        if (!call) {
+            return luaL_error(L, "async C++ function called outside CallLuaFunctionAsync");
+        }
+        call->ticket_ = nextTicket();
+        call->inFunction_ = true;
+        call->settled_ = false;
+        call->rejected_ = false;
+        int top = lua_gettop(L);
+        int status = invoke<F>(L, call->ticket_, std::type_identity<typename Signature::Arguments>{});
+        call->inFunction_ = false;
+        if (status < 0) {
+            call->settled_ = true;
+            return lua_error(L);  // Message pushed by invoke, its locals are gone
+        }
+        if (call->settled_) {
+            return finishAwait(L, call, top);
+        }
+        call->awaiting_ = true;
+        return lua_yieldk(L, 0, static_cast<lua_KContext>(top), &continuation);
+    }
+
+    // Runs when the promise resumes the thread; the results are above ctx
+    static int continuation(lua_State* L, int, lua_KContext ctx) {
+        Call* call = find(L, L);
+        if (!call) {
+            return luaL_error(L, "async call was abandoned");
+        }
+        return finishAwait(L, call, static_cast<int>(ctx));
+    }
+
+    static int finishAwait(lua_State* L, Call* call, int top) {
+        if (call->rejected_) {
+            call->rejected_ = false;
+            return lua_error(L);
+        }
+        return lua_gettop(L) - top;
+    }
+
+    // 0 on success, -1 with the error message pushed
+    template<typename F, typename Promise, typename... Args>
+    static int invoke(lua_State* L, uint64_t ticket, std::type_identity<std::tuple<Promise, Args...>>);
+};
+
+// Completion handle of one await. Copyable; the first resolve or reject
+// wins, later ones (or ones for an abandoned call) return false.
+class LuaPromise {
+public:
+    // Resume the script with values as the results of the async function
+    template<typename... Values>
+    bool resolve(const Values&... values) const {
+        LuaAsync::Call* call = pending();
+        if (!call) {
+            return false;
+        }
+        if (!lua_checkstack(thread_, static_cast<int>(sizeof...(Values)) + 1)) {
+            return reject("Lua stack overflow while resolving a LuaPromise");
+        }
+        (LuaFunctionCaller::pushToLuaStack(thread_, values), ...);
+        complete(call, static_cast<int>(sizeof...(Values)));
+        return true;
+    }
+
+    // Raise message as a Lua error where the script called the async function
+    bool reject(std::string_view message) const {
+        LuaAsync::Call* call = pending();
+        if (!call) {
+            return false;
+        }
+        lua_pushlstring(thread_, message.data(), message.size());
+        call->rejected_ = true;
+        complete(call, 1);
+        return true;
+    }
+
+    lua_State* state() const { return state_; }
+
+private:
+    friend class LuaAsync;
+
+    LuaPromise(lua_State* state, lua_State* thread, uint64_t ticket)
+        : state_(state), thread_(thread), ticket_(ticket) {}
+
+    // The thread is only dereferenced once the registry confirms it is alive
+    LuaAsync::Call* pending() const {
+        LuaAsync::Call* call = LuaAsync::find(state_, thread_);
+        if (!call || call->ticket_ != ticket_ || call->settled_) {
+            return nullptr;
+        }
+        call->settled_ = true;
+        return call;
+    }
+
+    // Completed inside the async function, the trampoline returns the values
+    static void complete(LuaAsync::Call* call, int nargs) {
+        if (!call->inFunction_) {
+            call->awaiting_ = false;
+            call->resume(nargs);
+        }
+    }
+
+    lua_State* state_;
+    lua_State* thread_;
+    uint64_t ticket_;
+};
+
+template<typename F, typename Promise, typename... Args>
+int LuaAsync::invoke(lua_State* L, uint64_t ticket, std::type_identity<std::tuple<Promise, Args...>>) {
+    static_assert(std::is_same_v<std::remove_cvref_t<Promise>, LuaPromise>, "An async C++ function takes a LuaPromise first");
+    int argument = 0;
+    try {
+        F* f = &LuaCppFunction::callable<F>(L);
+
+        std::tuple<LuaCppFunction::Stored<Args>...> values{LuaCppFunction::readArgument<Args>(L, argument)...};
+        argument = 0;
+        LuaPromise promise(find(L, L)->state_, L, ticket);
+        std::apply([&](auto&... value) {
+            (*f)(promise, static_cast<LuaCppFunction::Passed<Args>>(value)...);
+        }, values);
+        return 0;
+    } catch (const std::exception& e) {
+        LuaCppFunction::pushError(L, argument, e.what());
+    } catch (...) {
+        LuaCppFunction::pushError(L, argument, "unknown C++ exception");
+    }
+    return -1;
+}
+
+// Awaitable result of CallLuaFunctionAsync. The call starts when it is
+// created and runs up to its first await, so the object is neither copied
+// nor moved; co_await it directly or keep it in place until awaited.
+// Errors, including result conversions, are rethrown by co_await.
+template<typename... ReturnTypes>
+class LuaAsyncCall : private LuaAsync::Call {
+public:
+    using Result = typename LuaTryResult<ReturnTypes...>::type;
+
+    template<typename Function, typename... Args>
+    LuaAsyncCall(lua_State* L, const Function& function, Args&&... args) {
+        attach(L, LuaFunctionCaller::functionName(function));
+        try {
+            if (!lua_checkstack(thread_, static_cast<int>(sizeof...(Args)) + 1)) {
+                throw std::runtime_error("Lua stack overflow while starting an async call");
+            }
+            LuaFunctionCaller::pushFunction(thread_, function);
+            (LuaFunctionCaller::pushToLuaStack(thread_, args), ...);
+        } catch (...) {
+            detach();
+            throw;
+        }
+        resume(static_cast<int>(sizeof...(Args)));
+    }
+
+    // True once the Lua function returned or failed
+    bool done() const { return done_; }
+
+    bool await_ready() const noexcept {
+        return done_;
+    }
+
+    bool await_suspend(std::coroutine_handle<> waiter) {
+        if (done_) {
+            return false;
+        }
+        waiter_ = waiter;
+        return true;
+    }
+
+    Result await_resume() {
+        if (error_) {
+            std::rethrow_exception(error_);
+        }
+        if constexpr (!std::is_void_v<Result>) {
+            return std::move(*result_);
+        }
+    }
+
+private:
+    using Stored = std::conditional_t<std::is_void_v<Result>, std::monostate, Result>;
+
+    void settle(lua_State* thread, int results) override {
+        if constexpr (!std::is_void_v<Result>) {
+            constexpr int expected = static_cast<int>(sizeof...(ReturnTypes));
+            // Adjust to the declared count like lua_pcall does
+            lua_settop(thread, lua_gettop(thread) - results + expected);
+            char debugstr[255];
+            snprintf(debugstr, sizeof(debugstr), "returned by %s()", name_.c_str());
+            if constexpr (sizeof...(ReturnTypes) == 1) {
+                result_.emplace(LuaFunctionCaller::readFromLuaStack<Result>(thread, debugstr, -1));
+            } else {
+                result_.emplace(readResults(thread, debugstr, std::index_sequence_for<ReturnTypes...>{}));
+            }
+        }
+    }
+
+    template<size_t... Is>
+    static Result readResults(lua_State* thread, const char* fn, std::index_sequence<Is...>) {
+        constexpr int expected = static_cast<int>(sizeof...(ReturnTypes));
+        return Result{LuaFunctionCaller::readFromLuaStack<ReturnTypes>(thread, fn, static_cast<int>(Is) - expected)...};
+    }
+
+    std::optional<Stored> result_;
+};
+
+// Call a Lua function that may await async C++ functions, from a C++20
+// coroutine:
+//   RegisterAsyncCppFunction(L, "fetch", [&loop](LuaPromise promise, std::string key) {
+//       loop.get(key, [promise](std::string value) { promise.resolve(value); });
+//   });
+//   std::string page = co_await CallLuaFunctionAsync<std::string>(L, "render", id);
+// where render calls fetch() like any other function.
+template<typename... ReturnTypes, typename Function, typename... Args>
+LuaAsyncCall<ReturnTypes...> CallLuaFunctionAsync(lua_State* L, const Function& function, Args&&... args) {
+    return LuaAsyncCall<ReturnTypes...>(L, function, std::forward<Args>(args)...);
+}
+
+template<typename... ReturnTypes, typename... Args>
+LuaAsyncCall<ReturnTypes...> CallLuaFunctionAsync(const LuaFunctionRef& function, Args&&... args) {
+    return LuaAsyncCall<ReturnTypes...>(function.state(), function, std::forward<Args>(args)...);
+}
+
+// Register an async C++ function as the global function name
+template<typename Callable>
+void RegisterAsyncCppFunction(lua_State* L, std::string_view name, Callable&& callable) {
+    lua_pushglobaltable(L);
+    lua_pushlstring(L, name.data(), name.size());
+    LuaAsync::push(L, std::forward<Callable>(callable));
+    lua_settable(L, -3);
+    lua_pop(L, 1);
+}
+
+#endif
@@ -2,15 +2,28 @@
 #define LUA_LUACALLSFROMCPP
 
 #include <lua.hpp>
+#include <array>
+#include <concepts>
+#include <cstring>
+#include <span>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 #include <unordered_map>
 #include <tuple>
 #include <type_traits>
 #include <stdexcept>
 #include <optional>
+#include <ranges>
+#include <memory>
+#include <functional>
 #include <variant>
 #include <format>
+#include <version>
+#ifdef __cpp_lib_expected
+#include <expected>
+#endif
 
 #define LUA_TINTEGER 200
 #define LUA_BASIC_TYPES lua_Integer, lua_Number, bool, std::string, std::nullopt_t
@@ -36,7 +49,7 @@ struct BasicLuaTypeHasher {
         return std::visit([](const auto& v) -> size_t {
             using T = std::decay_t<decltype(v)>;
             if constexpr (std::is_same_v<T, std::nullopt_t>) {
-                throw std::invalid_argument("Cannot hash std::nullopt_t");
+                return 0x9e3779b97f4a7c15ull;  // nil is a valid C++ map key
             } else {
                 return std::hash<T>{}(v);
             }
@@ -44,6 +57,426 @@ struct BasicLuaTypeHasher {
     }
 };
 
+// Field of a struct declared with LUA_STRUCT
+template<typename Struct, typename Member>
+struct LuaStructField {
+    std::string_view name;
+    Member Struct::* pointer;
+};
+
+// Specialized by LUA_STRUCT, fields is a tuple of LuaStructField
+template<typename T>
+struct LuaStructTraits;
+
+// Specialized by proxies that lend the caller's memory to Lua, e.g. LuaView,
+// so they are refused where an argument outlives the call
+template<typename T>
+struct LuaLendsMemory : std::false_type {};
+
+#define LUA_STRUCT_PARENS ()
+#define LUA_STRUCT_EXPAND(...) LUA_STRUCT_EXPAND3(LUA_STRUCT_EXPAND3(LUA_STRUCT_EXPAND3(LUA_STRUCT_EXPAND3(__VA_ARGS__))))
+#define LUA_STRUCT_EXPAND3(...) LUA_STRUCT_EXPAND2(LUA_STRUCT_EXPAND2(LUA_STRUCT_EXPAND2(LUA_STRUCT_EXPAND2(__VA_ARGS__))))
+#define LUA_STRUCT_EXPAND2(...) LUA_STRUCT_EXPAND1(LUA_STRUCT_EXPAND1(LUA_STRUCT_EXPAND1(LUA_STRUCT_EXPAND1(__VA_ARGS__))))
+#define LUA_STRUCT_EXPAND1(...) __VA_ARGS__
+#define LUA_STRUCT_FOR_EACH(Type, ...) __VA_OPT__(LUA_STRUCT_EXPAND(LUA_STRUCT_FOR_EACH_HELPER(Type, __VA_ARGS__)))
+#define LUA_STRUCT_FOR_EACH_HELPER(Type, field, ...) \
+    LuaStructField<Type, decltype(Type::field)>{#field, &Type::field}, \
+    __VA_OPT__(LUA_STRUCT_FOR_EACH_AGAIN LUA_STRUCT_PARENS (Type, __VA_ARGS__))
+#define LUA_STRUCT_FOR_EACH_AGAIN() LUA_STRUCT_FOR_EACH_HELPER
+
+// Make an aggregate usable as an argument and return type, exchanged with Lua
+// as a table keyed by field name. Use at global scope after the definition:
+//   struct Event { lua_Integer id; std::string kind; double score; };
+//   LUA_STRUCT(Event, id, kind, score)
+#define LUA_STRUCT(Type, ...) \
+    template<> \
+    struct LuaStructTraits<Type> { \
+        static constexpr auto fields = std::tuple{LUA_STRUCT_FOR_EACH(Type, __VA_ARGS__)}; \
+    };
+
+// Handle to a Lua function resolved once and pinned in the registry.
+// Paths like "mod.sub.fn" are walked from the globals table at construction,
+// so calls through the handle skip the name lookup entirely.
+// The handle must not outlive the lua_State it was created from.
+class LuaFunctionRef {
+public:
+    LuaFunctionRef() = default;
+
+    LuaFunctionRef(lua_State* L, std::string_view path) : state_(L), name_(path) {
+        lua_pushglobaltable(L);
+        size_t begin = 0;
+        while (true) {
+            size_t end = path.find('.', begin);
+            std::string_view segment = path.substr(begin, end == std::string_view::npos ? std::string_view::npos : end - begin);
+            if (!lua_istable(L, -1) || segment.empty()) {
+                lua_pop(L, 1);
+                throw std::runtime_error("Function '" + name_ + "' is not a valid Lua function.");
+            }
+            lua_pushlstring(L, segment.data(), segment.size());
+            lua_gettable(L, -2);
+            lua_remove(L, -2);  // Drop the parent table, keep the field
+            if (end == std::string_view::npos) {
+                break;
+            }
+            begin = end + 1;
+        }
+
+        if (!lua_isfunction(L, -1)) {
+            lua_pop(L, 1);
+            throw std::runtime_error("Function '" + name_ + "' is not a valid Lua function.");
+        }
+        ref_ = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+
+    // Pin the function currently at the top of the stack (popped)
+    static LuaFunctionRef fromStack(lua_State* L, std::string_view name) {
+        if (!lua_isfunction(L, -1)) {
+            lua_pop(L, 1);
+            throw std::runtime_error("Function '" + std::string(name) + "' is not a valid Lua function.");
+        }
+        LuaFunctionRef result;
+        result.state_ = L;
+        result.name_ = name;
+        result.ref_ = luaL_ref(L, LUA_REGISTRYINDEX);
+        return result;
+    }
+
+    LuaFunctionRef(const LuaFunctionRef&) = delete;
+    LuaFunctionRef& operator=(const LuaFunctionRef&) = delete;
+
+    LuaFunctionRef(LuaFunctionRef&& other) noexcept
+        : state_(std::exchange(other.state_, nullptr)), ref_(std::exchange(other.ref_, LUA_NOREF)), name_(std::move(other.name_)) {}
+
+    LuaFunctionRef& operator=(LuaFunctionRef&& other) noexcept {
+        if (this != &other) {
+            reset();
+            state_ = std::exchange(other.state_, nullptr);
+            ref_ = std::exchange(other.ref_, LUA_NOREF);
+            name_ = std::move(other.name_);
+        }
+        return *this;
+    }
+
+    ~LuaFunctionRef() {
+        reset();
+    }
+
+    void reset() {
+        if (state_ && ref_ != LUA_NOREF) {
+            luaL_unref(state_, LUA_REGISTRYINDEX, ref_);
+        }
+        state_ = nullptr;
+        ref_ = LUA_NOREF;
+    }
+
+    // Push the pinned function onto the stack of L (or a thread sharing its registry)
+    void push(lua_State* L) const {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, ref_);
+    }
+
+    lua_State* state() const { return state_; }
+    int ref() const { return ref_; }
+    const std::string& name() const { return name_; }
+    explicit operator bool() const { return ref_ != LUA_NOREF; }
+
+    // Same return type rules as CallLuaFunction, no return types means void
+    template<typename... ReturnTypes, typename... Args>
+    auto operator()(Args&&... args) const;
+
+private:
+    lua_State* state_ = nullptr;
+    int ref_ = LUA_NOREF;
+    std::string name_;
+};
+
+// Typed handle: LuaFunction<int> add(L, "add"); int r = add(5, 3);
+template<typename... ReturnTypes>
+class LuaFunction : public LuaFunctionRef {
+public:
+    using LuaFunctionRef::LuaFunctionRef;
+
+    LuaFunction(LuaFunctionRef&& ref) : LuaFunctionRef(std::move(ref)) {}
+
+    template<typename... Args>
+    auto operator()(Args&&... args) const {
+        return LuaFunctionRef::operator()<ReturnTypes...>(std::forward<Args>(args)...);
+    }
+};
+
+// Userdata at index whose metatable is the one cached under metatableKey,
+// raises a Lua argument error otherwise. For metamethods, which scripts can
+// call with any value through debug.getmetatable.
+inline void* CheckLuaUserdata(lua_State* L, int index, const void* metatableKey, const char* typeName) {
+    void* userdata = lua_touserdata(L, index);
+    if (userdata && lua_getmetatable(L, index)) {
+        lua_rawgetp(L, LUA_REGISTRYINDEX, metatableKey);
+        bool matches = lua_rawequal(L, -1, -2);
+        lua_pop(L, 2);
+        if (matches) {
+            return userdata;
+        }
+    }
+    luaL_argerror(L, index, lua_pushfstring(L, "%s expected", typeName));
+    return nullptr;
+}
+
+// Userdata lending C++ memory to Lua, shared by LuaBuffer and LuaView. The
+// userdata is pinned in the registry while lent; detach() zeroes its payload,
+// so metamethods see a null pointer instead of dangling memory, and unpins it.
+// Copies start without a userdata of their own.
+class LuaLentUserdata {
+public:
+    LuaLentUserdata() = default;
+    LuaLentUserdata(const LuaLentUserdata&) {}
+    LuaLentUserdata& operator=(const LuaLentUserdata&) = delete;
+
+    ~LuaLentUserdata() {
+        detach();
+    }
+
+    // Push a new userdata with the metatable from pushMetatable and return
+    // its payload, which the caller fills in. Detaches the previous one.
+    template<typename Payload>
+    Payload* push(lua_State* L, void (*pushMetatable)(lua_State*)) {
+        static_assert(std::is_trivially_copyable_v<Payload>, "Lent payloads are zeroed on detach");
+        detach();
+        auto* payload = static_cast<Payload*>(lua_newuserdata(L, sizeof(Payload)));
+        pushMetatable(L);
+        lua_setmetatable(L, -2);
+        lua_pushvalue(L, -1);
+        ref_ = luaL_ref(L, LUA_REGISTRYINDEX);
+        state_ = L;
+        payload_ = payload;
+        size_ = sizeof(Payload);
+        return payload;
+    }
+
+    void detach() {
+        if (payload_) {
+            std::memset(payload_, 0, size_);
+            luaL_unref(state_, LUA_REGISTRYINDEX, ref_);
+            payload_ = nullptr;
+        }
+    }
+
+private:
+    void* payload_ = nullptr;
+    size_t size_ = 0;
+    lua_State* state_ = nullptr;
+    int ref_ = LUA_NOREF;
+};
+
+// Lends a contiguous numeric buffer to Lua as a userdata with __index and
+// __len (plus __newindex for non-const T) instead of copying it into a table.
+// Indices are 1-based like a Lua array. The userdata is detached when the
+// LuaBuffer is destroyed, so a script that keeps it past the call sees an
+// empty buffer rather than dangling memory.
+//   std::vector<double> samples = ...;
+//   CallLuaFunction<double>(L, "rms", LuaBuffer(samples));
+template<typename T>
+class LuaBuffer {
+    static_assert(std::is_arithmetic_v<T> && !std::is_same_v<std::remove_const_t<T>, bool>, "LuaBuffer needs a numeric element type");
+
+public:
+    template<std::ranges::contiguous_range Range>
+    LuaBuffer(Range&& range) : data_(std::ranges::data(range), std::ranges::size(range)) {}
+
+    LuaBuffer(const LuaBuffer& other) : data_(other.data_) {}
+    LuaBuffer& operator=(const LuaBuffer&) = delete;
+
+    std::span<T> data() const { return data_; }
+
+    // Push the userdata, one LuaBuffer lends its memory to one userdata at a time
+    void push(lua_State* L) const {
+        Payload* payload = userdata_.push<Payload>(L, &pushMetatable);
+        payload->data = data_.data();
+        payload->size = data_.size();
+    }
+
+private:
+    struct Payload {
+        T* data;
+        size_t size;
+    };
+
+    // One metatable per element type, cached in the registry under a static address
+    static inline const char kMetatableKey = 0;
+
+    static void pushMetatable(lua_State* L) {
+        if (lua_rawgetp(L, LUA_REGISTRYINDEX, &kMetatableKey) != LUA_TNIL) {
+            return;
+        }
+        lua_pop(L, 1);
+        lua_createtable(L, 0, 4);
+        lua_pushliteral(L, "LuaBuffer");
+        lua_setfield(L, -2, "__metatable");  // getmetatable() cannot reach the metamethods
+        lua_pushcfunction(L, &LuaBuffer::index);
+        lua_setfield(L, -2, "__index");
+        lua_pushcfunction(L, &LuaBuffer::length);
+        lua_setfield(L, -2, "__len");
+        if constexpr (!std::is_const_v<T>) {
+            lua_pushcfunction(L, &LuaBuffer::newIndex);
+            lua_setfield(L, -2, "__newindex");
+        }
+        lua_pushvalue(L, -1);
+        lua_rawsetp(L, LUA_REGISTRYINDEX, &kMetatableKey);
+    }
+
+    static Payload* checkPayload(lua_State* L) {
+        return static_cast<Payload*>(CheckLuaUserdata(L, 1, &kMetatableKey, "LuaBuffer"));
+    }
+
+    static int index(lua_State* L) {
+        auto* payload = checkPayload(L);
+        int isnum;
+        lua_Integer i = lua_tointegerx(L, 2, &isnum);
+        if (!isnum || i < 1 || static_cast<lua_Unsigned>(i) > payload->size) {
+            lua_pushnil(L);
+        } else if constexpr (std::is_integral_v<T>) {
+            lua_pushinteger(L, static_cast<lua_Integer>(payload->data[i - 1]));
+        } else {
+            lua_pushnumber(L, static_cast<lua_Number>(payload->data[i - 1]));
+        }
+        return 1;
+    }
+
+    static int length(lua_State* L) {
+        auto* payload = checkPayload(L);
+        lua_pushinteger(L, static_cast<lua_Integer>(payload->size));
+        return 1;
+    }
+
+    static int newIndex(lua_State* L) {
+        auto* payload = checkPayload(L);
+        int isnum;
+        lua_Integer i = lua_tointegerx(L, 2, &isnum);
+        if (!isnum || i < 1 || static_cast<lua_Unsigned>(i) > payload->size) {
+            return luaL_error(L, "LuaBuffer index out of range");
+        }
+        if constexpr (std::is_integral_v<T>) {
+            payload->data[i - 1] = static_cast<T>(luaL_checkinteger(L, 3));
+        } else {
+            payload->data[i - 1] = static_cast<T>(luaL_checknumber(L, 3));
+        }
+        return 0;
+    }
+
+    std::span<T> data_;
+    mutable LuaLentUserdata userdata_;
+};
+
+template<typename Range>
+LuaBuffer(Range&&) -> LuaBuffer<std::remove_reference_t<std::ranges::range_reference_t<Range>>>;
+
+// Instrumentation of untracked calls: every hook is empty and inlines away.
+// Functions wrapped by LuaCallProfiler::track supply a recording scope instead.
+struct LuaNoInstrumentation {
+    void pushed(size_t) {}
+    void called() {}
+    void finished(size_t) {}
+};
+
+enum class LuaErrorCode {
+    NotAFunction,   // The name or handle does not resolve to a function
+    StackOverflow,  // lua_checkstack failed
+    Runtime,        // LUA_ERRRUN raised by the script
+    Memory,         // LUA_ERRMEM
+    Handler,        // LUA_ERRERR, the message handler itself failed
+    TypeMismatch,   // A result could not be converted to the requested type
+};
+
+// Error returned by TryCallLuaFunction. Only the raw parts are captured when
+// the call fails; message() formats them on first use. Runtime errors carry
+// the traceback collected by messageHandler while the failing frames were
+// still live.
+class LuaError {
+public:
+    LuaError(LuaErrorCode code, std::string_view function, std::string detail = {})
+        : code_(code), function_(function), detail_(std::move(detail)) {}
+
+    // A result of Lua type luaType where `expected` was requested
+    static LuaError mismatch(std::string_view function, size_t result, int luaType, const char* expected) {
+        LuaError error(LuaErrorCode::TypeMismatch, function);
+        error.result_ = result;
+        error.luaType_ = luaType;
+        error.expected_ = expected;
+        return error;
+    }
+
+    // Error value left by a failed lua_pcall that used messageHandler
+    static LuaError fromStack(lua_State* L, int status, std::string_view function) {
+        LuaErrorCode code = status == LUA_ERRMEM ? LuaErrorCode::Memory : status == LUA_ERRERR ? LuaErrorCode::Handler : LuaErrorCode::Runtime;
+        size_t len = 0;
+        const char* str = lua_tolstring(L, -1, &len);
+        LuaError error(code, function, str ? std::string(str, len) : std::string("unknown error"));
+        size_t split = error.detail_.rfind(kTracebackHeader);
+        if (split != std::string::npos) {
+            error.traceback_ = error.detail_.substr(split + 1);
+            error.detail_.resize(split);
+        }
+        return error;
+    }
+
+    // lua_pcall message handler: appends a traceback to the error message
+    static int messageHandler(lua_State* L) {
+        const char* message = luaL_tolstring(L, 1, nullptr);
+        luaL_traceback(L, L, message, 1);
+        return 1;
+    }
+
+    LuaErrorCode code() const { return code_; }
+    const std::string& function() const { return function_; }
+    const std::string& traceback() const { return traceback_; }
+
+    const std::string& message() const {
+        if (message_.empty()) {
+            switch (code_) {
+                case LuaErrorCode::NotAFunction:
+                    message_ = "Function '" + function_ + "' is not a valid Lua function.";
+                    break;
+                case LuaErrorCode::StackOverflow:
+                    message_ = std::format("Lua stack overflow calling {}()", function_);
+                    break;
+                case LuaErrorCode::TypeMismatch:
+                    message_ = expected_ ? std::format("Unexpected {} returned by {}() (result {}), expected {}", lua_typename(nullptr, luaType_), function_, result_ + 1, expected_) : detail_;
+                    break;
+                default:
+                    message_ = detail_;
+                    break;
+            }
+        }
+        return message_;
+    }
+
+private:
+    static constexpr std::string_view kTracebackHeader = "\nstack traceback:";
+
+    LuaErrorCode code_;
+    int luaType_ = LUA_TNONE;
+    size_t result_ = 0;
+    const char* expected_ = nullptr;
+    std::string function_;
+    std::string detail_;
+    std::string traceback_;
+    mutable std::string message_;
+};
+
+// Value type of a TryCallLuaFunction: void, the single type or a tuple
+template<typename... ReturnTypes>
+struct LuaTryResult {
+    using type = std::tuple<ReturnTypes...>;
+};
+
+template<typename ReturnType>
+struct LuaTryResult<ReturnType> {
+    using type = ReturnType;
+};
+
+template<>
+struct LuaTryResult<> {
+    using type = void;
+};
+
 class LuaFunctionCaller {
 private:
 
@@ -54,26 +487,38 @@ template<typename T>
 struct is_optional<std::optional<T>> : std::true_type {};
 
 template<typename T>
-struct MapTypesExtractor;
-
-template<typename Key, typename Value, typename Hash, typename KeyEqual, typename Allocator>
-struct MapTypesExtractor<std::unordered_map<Key, Value, Hash, KeyEqual, Allocator>> {
-    using key_type = Key;
-    using mapped_type = Value;
+struct MapTypesExtractor {
+    using key_type = typename T::key_type;
+    using mapped_type = typename T::mapped_type;
 };
-// Helper to check if a type is std::unordered_map
+
+// Helper to check if a type is a char string with any allocator (std::string, std::pmr::string)
 template<typename T>
-struct is_unordered_map : std::false_type {};
+struct is_basic_string : std::false_type {};
 
-template<typename K, typename V>
-struct is_unordered_map<std::unordered_map<K, V>> : std::true_type {};
+template<typename Traits, typename Allocator>
+struct is_basic_string<std::basic_string<char, Traits, Allocator>> : std::true_type {};
 
-// Helper to check if a type is std::vector
+// Helper to check if a type is map-like: std::unordered_map and std::map with
+// any hash, comparator or allocator (including std::pmr), flat maps, ...
 template<typename T>
-struct is_vector : std::false_type {};
+struct is_map_container : std::bool_constant<requires(T& c) {
+    typename T::key_type;
+    typename T::mapped_type;
+    c.try_emplace(std::declval<typename T::key_type>());
+    c.begin();
+    c.end();
+}> {};
 
+// Helper to check if a type is a growable sequence: std::vector with any
+// allocator (including std::pmr), std::deque, ...
 template<typename T>
-struct is_vector<std::vector<T>> : std::true_type {};
+struct is_sequence_container : std::bool_constant<!is_basic_string<T>::value && requires(T& c, size_t n) {
+    typename T::value_type;
+    c.emplace_back();
+    c.resize(n);
+    c[n];
+}> {};
 
 template <typename T>
 struct is_array : std::false_type {};
@@ -81,6 +526,27 @@ struct is_array : std::false_type {};
 template <typename T, size_t N>
 struct is_array<std::array<T, N>> : std::true_type {};
 
+template <typename T>
+struct is_span : std::false_type {};
+
+template <typename T, size_t N>
+struct is_span<std::span<T, N>> : std::true_type {};
+
+template <typename T>
+struct is_lua_buffer : std::false_type {};
+
+template <typename T>
+struct is_lua_buffer<LuaBuffer<T>> : std::true_type {};
+
+template <typename T>
+struct is_reference_wrapper : std::false_type {};
+
+template <typename T>
+struct is_reference_wrapper<std::reference_wrapper<T>> : std::true_type {};
+
+template <typename T>
+struct is_lua_struct : std::bool_constant<requires { LuaStructTraits<T>::fields; }> {};
+
 template <typename T>
 struct is_array_size_pair : std::false_type {};
 
@@ -107,82 +573,213 @@ struct is_string_bool_pair<std::pair<std::array<char, N>, bool>>
 template<typename T>
 struct is_BasicLuaType : std::false_type {};
     
-static bool isList(lua_State* L, int index) {
-    // Normalize the index to handle negative indices
-    index = lua_absindex(L, index);
+// Copy a Lua string into a fixed-size buffer, always null-terminated.
+// Returns false if the string was truncated.
+template<size_t N>
+static bool copyLuaString(lua_State* L, int index, std::array<char, N>& buffer) {
+    static_assert(N > 0, "String<N> needs room for the terminator");
+    size_t len;
+    const char* str = lua_tolstring(L, index, &len);
+    size_t copied = len < N ? len : N - 1;
+    std::memcpy(buffer.data(), str, copied);
+    buffer[copied] = '\0';
+    return len < N;
+}
 
-    // Check if the value is a table
-    if (!lua_istable(L, index)) {
+// Contiguous numbers (vector, array, span), pushed through the numeric fast path
+template<typename T>
+static constexpr bool isNumericRange() {
+    if constexpr (std::ranges::contiguous_range<T> && !is_basic_string<T>::value) {
+        using ValueType = std::ranges::range_value_t<T>;
+        return std::is_arithmetic_v<ValueType> && !std::is_same_v<ValueType, bool>;
+    } else {
         return false;
     }
+}
+
+// Types readIntoFromLuaStack fills in place instead of assigning a fresh value
+template<typename T>
+static constexpr bool readsInPlace() {
+    return is_basic_string<T>::value || is_optional<T>::value || is_sequence_container<T>::value || is_map_container<T>::value || is_lua_struct<T>::value;
+}
 
-    // Get the length of the table
-    lua_len(L, index);
-    lua_Integer tableLength = lua_tointeger(L, -1);
+// Push the field-name keys of a LUA_STRUCT type. They are created once per
+// state and kept in the registry, so pushing a key is a plain value copy and
+// lookups reuse the hash Lua stored with the interned string.
+template<typename T>
+static void pushStructKeys(lua_State* L) {
+    static const char registryKey = 0;
+    if (lua_rawgetp(L, LUA_REGISTRYINDEX, &registryKey) != LUA_TNIL) {
+        return;
+    }
     lua_pop(L, 1);
+    constexpr size_t fieldCount = std::tuple_size_v<decltype(LuaStructTraits<T>::fields)>;
+    lua_createtable(L, fieldCount, 0);
+    std::apply([L](const auto&... field) {
+        lua_Integer i = 0;
+        ((lua_pushlstring(L, field.name.data(), field.name.size()), lua_rawseti(L, -2, ++i)), ...);
+    }, LuaStructTraits<T>::fields);
+    lua_pushvalue(L, -1);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &registryKey);
+}
 
-    // If length is 0, it can be considered a list (empty list)
-    if (tableLength == 0) {
-        return true;
+// Construct a container element with the container's allocator when it has one
+template<typename T, typename Container>
+static T makeElement(const Container& container) {
+    if constexpr (requires { container.get_allocator(); }) {
+        return std::make_obj_using_allocator<T>(container.get_allocator());
+    } else {
+        return T();
     }
+}
 
-    // Check for consecutive integer keys starting from 1
-    lua_Integer maxKey = 0;
-    lua_pushnil(L);  // Start with the first key (nil)
-    while (lua_next(L, index)) {
-        // Check if the key is an integer
-        if (!lua_isinteger(L, -2)) {
-            lua_pop(L, 2);
-            return false;
-        }
+// Decoder picked for a scalar type at compile time. Every plan is one
+// lua_type check and one conversion call. The check cannot be folded into
+// lua_tointegerx or lua_tonumberx: their isnum flag is also set for numeric
+// strings such as "10", which readFromLuaStack rejects. It cannot be hoisted
+// out of container loops either, as each table element has its own type.
+enum class LuaScalarPlan {
+    None,     // Generic dispatch in readFromLuaStack
+    Integer,  // lua_tointegerx, lua_tonumber only for non-integral floats
+    Number,   // lua_tonumber
+    Boolean,  // lua_toboolean
+};
 
-        lua_Integer key = lua_tointeger(L, -2);
+template<typename T>
+static constexpr LuaScalarPlan scalarPlan() {
+    if constexpr (std::is_same_v<T, bool>) {
+        return LuaScalarPlan::Boolean;
+    } else if constexpr (std::is_integral_v<T>) {
+        return LuaScalarPlan::Integer;
+    } else if constexpr (std::is_floating_point_v<T>) {
+        return LuaScalarPlan::Number;
+    } else {
+        return LuaScalarPlan::None;
+    }
+}
 
-        // Check if key is greater than 0
-        if (key < 1) {
-            lua_pop(L, 2);
+// Fast path of a planned scalar: one type check and one conversion call.
+// False leaves out untouched; readFromLuaStack then handles the remaining
+// conversions (booleans as integers) and reports mismatches.
+template<typename T>
+static bool decodeScalar(lua_State* L, int index, T& out) {
+    constexpr LuaScalarPlan plan = scalarPlan<T>();
+    if constexpr (plan == LuaScalarPlan::Integer) {
+        if (lua_type(L, index) != LUA_TNUMBER) {
             return false;
         }
-
-        // Keep track of the largest key
-        if (key > maxKey) {
-            maxKey = key;
+        int isint;
+        lua_Integer value = lua_tointegerx(L, index, &isint);
+        out = isint ? static_cast<T>(value) : static_cast<T>(lua_tonumber(L, index));
+        return true;
+    } else if constexpr (plan == LuaScalarPlan::Number) {
+        if (lua_type(L, index) != LUA_TNUMBER) {
+            return false;
         }
-
-        lua_pop(L, 1);  // Pop the value, keep the key for the next iteration
+        out = static_cast<T>(lua_tonumber(L, index));
+        return true;
+    } else if constexpr (plan == LuaScalarPlan::Boolean) {
+        if (lua_type(L, index) != LUA_TBOOLEAN) {
+            return false;
+        }
+        out = lua_toboolean(L, index) != 0;
+        return true;
+    } else {
+        return false;
     }
+}
 
-    // Ensure that maxKey matches table length (allowing nil values in the middle)
-    return maxKey == tableLength;
+// Sequences whose elements all decode through a scalar plan
+template<typename T>
+static constexpr bool hasScalarElements() {
+    if constexpr (is_sequence_container<T>::value) {
+        return scalarPlan<typename T::value_type>() != LuaScalarPlan::None;
+    } else {
+        return false;
+    }
 }
 
+// Read a container element through its scalar plan when it has one
+template<typename T>
+static T readElement(lua_State* L, const char* fn, int index) {
+    if constexpr (scalarPlan<T>() != LuaScalarPlan::None) {
+        T value;
+        if (decodeScalar(L, index, value)) {
+            return value;
+        }
+    }
+    return readFromLuaStack<T>(L, fn, index);
+}
 
-static bool isDict(lua_State* L, int index) {
+// Single lua_next pass over a list-like table. store(key) is called with the
+// value at the top of the stack, in traversal order (keys may arrive out of
+// order for keys living in the hash part). Holes are passed to store as nil.
+// Returns the list length.
+template<typename Store>
+static lua_Integer decodeList(lua_State* L, const char* fn, int index, Store&& store) {
     // Normalize the index to handle negative indices
     index = lua_absindex(L, index);
 
-    // Check if the value is a table
     if (!lua_istable(L, index)) {
-        return false;
+        throw std::runtime_error(std::format("Unexpected non-list type {}, expected a list", fn));
+    }
+
+    // An empty border is considered an empty list
+    lua_Integer tableLength = static_cast<lua_Integer>(lua_rawlen(L, index));
+    if (tableLength == 0) {
+        return 0;
     }
 
-    // Check for nil keys or other invalid key types
-    lua_pushnil(L);  // Push nil to start the iteration
+    lua_Integer maxKey = 0;
+    lua_Integer count = 0;
+    lua_pushnil(L);  // Start with the first key (nil)
     while (lua_next(L, index)) {
-        // Check key type
-        int keyType = lua_type(L, -2);
-        
-        // Reject nil keys
-        if (keyType == LUA_TNIL) {
+        if (!lua_isinteger(L, -2) || lua_tointeger(L, -2) < 1) {
+            const char* keyType = lua_isinteger(L, -2) ? "non-positive integer" : luaL_typename(L, -2);
             lua_pop(L, 2);
-            return false;
+            throw std::runtime_error(std::format("Unexpected non-list type {}, expected a list (found a {} key)", fn, keyType));
+        }
+
+        lua_Integer key = lua_tointeger(L, -2);
+        if (key > tableLength) {
+            lua_pop(L, 2);
+            throw std::runtime_error(std::format("Unexpected non-list type {}, expected a list (key {} is past length {})", fn, key, tableLength));
+        }
+        try {
+            store(key);
+        } catch (...) {
+            lua_pop(L, 2);
+            throw;
         }
 
-        lua_pop(L, 1);  // Pop value, keep the key for next iteration
+        if (key > maxKey) {
+            maxKey = key;
+        }
+        ++count;
+        lua_pop(L, 1);  // Pop the value, keep the key for the next iteration
     }
 
-    // If we reach here, the table passes all checks
-    return true;
+    // Keys never exceed the length, so a smaller maxKey means the border is
+    // not the last key (allowing nil values in the middle)
+    if (maxKey != tableLength) {
+        throw std::runtime_error(std::format("Unexpected non-list type {}, expected a list (largest key {} does not match length {})", fn, maxKey, tableLength));
+    }
+
+    // Holes were skipped by lua_next, decode them as nil
+    if (count != maxKey) {
+        for (lua_Integer i = 1; i <= maxKey; ++i) {
+            if (lua_rawgeti(L, index, i) == LUA_TNIL) {
+                try {
+                    store(i);
+                } catch (...) {
+                    lua_pop(L, 1);
+                    throw;
+                }
+            }
+            lua_pop(L, 1);
+        }
+    }
+    return maxKey;
 }
 
 /*
@@ -262,10 +859,145 @@ void checkType(lua_State* L, const char* fn, int type) {
     }
 }*/
 
-// Function to read from Lua stack
 public:
+// Container shapes, for proxies such as LuaView that dispatch on them
+template<typename T>
+static constexpr bool isMapLike() {
+    return is_map_container<T>::value;
+}
+
+template<typename T>
+static constexpr bool isOwnedString() {
+    return is_basic_string<T>::value;
+}
+
+// True if an argument of type T points into memory owned by someone else,
+// so a copy of it must not be kept past the call
+template<typename T>
+static constexpr bool lendsMemory() {
+    if constexpr (std::is_pointer_v<T> || std::is_same_v<T, std::string_view> || is_span<T>::value ||
+                  is_reference_wrapper<T>::value || is_lua_buffer<T>::value || LuaLendsMemory<T>::value) {
+        return true;
+    } else if constexpr (is_optional<T>::value || is_sequence_container<T>::value || is_array<T>::value) {
+        return lendsMemory<typename T::value_type>();
+    } else if constexpr (is_map_container<T>::value) {
+        return lendsMemory<typename MapTypesExtractor<T>::key_type>() || lendsMemory<typename MapTypesExtractor<T>::mapped_type>();
+    } else if constexpr (is_lua_struct<T>::value) {
+        return std::apply([](const auto&... field) {
+            return (lendsMemory<std::remove_cvref_t<decltype(std::declval<T&>().*(field.pointer))>>() || ...);
+        }, LuaStructTraits<T>::fields);
+    } else {
+        return false;
+    }
+}
+
+// True if T points into a Lua value instead of owning its data, such results
+// are left on the stack and must be read through LuaResultGuard
+template<typename T>
+static constexpr bool borrowsFromStack() {
+    if constexpr (std::is_same_v<T, std::string_view> || std::is_same_v<T, std::span<const char>>) {
+        return true;
+    } else if constexpr (is_optional<T>::value || is_sequence_container<T>::value) {
+        return borrowsFromStack<typename T::value_type>();
+    } else if constexpr (is_map_container<T>::value) {
+        return borrowsFromStack<typename MapTypesExtractor<T>::key_type>() || borrowsFromStack<typename MapTypesExtractor<T>::mapped_type>();
+    } else if constexpr (is_lua_struct<T>::value) {
+        return std::apply([](const auto&... field) {
+            return (borrowsFromStack<std::remove_cvref_t<decltype(std::declval<T&>().*(field.pointer))>>() || ...);
+        }, LuaStructTraits<T>::fields);
+    } else {
+        return false;
+    }
+}
+
+// Results that tryReadScalar decodes without throwing
+template<typename T>
+static constexpr bool readsWithoutThrowing() {
+    if constexpr (is_optional<T>::value) {
+        return readsWithoutThrowing<typename T::value_type>();
+    } else {
+        return std::is_same_v<T, BasicLuaType> || std::is_arithmetic_v<T> || is_basic_string<T>::value || is_string<T>::value;
+    }
+}
+
+// Same conversions as readFromLuaStack, but a mismatch returns the expected
+// type instead of throwing; nullptr means out holds the value
+template<typename T>
+static const char* tryReadScalar(lua_State* L, int index, T& out) {
+    if constexpr (is_optional<T>::value) {
+        if (lua_isnil(L, index)) {
+            out.reset();
+            return nullptr;
+        }
+        return tryReadScalar(L, index, out.emplace());
+    } else if constexpr (std::is_same_v<T, BasicLuaType>) {
+        switch (lua_type(L, index)) {
+            case LUA_TNIL:
+                out = std::nullopt;
+                return nullptr;
+            case LUA_TNUMBER:
+                if (lua_isinteger(L, index)) {
+                    out = lua_tointeger(L, index);
+                } else {
+                    out = lua_tonumber(L, index);
+                }
+                return nullptr;
+            case LUA_TBOOLEAN:
+                out = static_cast<bool>(lua_toboolean(L, index));
+                return nullptr;
+            case LUA_TSTRING: {
+                size_t len;
+                const char* str = lua_tolstring(L, index, &len);
+                out = std::string(str, len);
+                return nullptr;
+            }
+            default:
+                return "a BasicLuaType";
+        }
+    } else if constexpr (std::is_integral_v<T>) {
+        if (decodeScalar(L, index, out)) {
+            return nullptr;
+        }
+        switch (lua_type(L, index)) {
+            case LUA_TNUMBER:
+                out = static_cast<T>(lua_tonumber(L, index));
+                return nullptr;
+            case LUA_TBOOLEAN:
+                out = static_cast<T>(lua_toboolean(L, index));
+                return nullptr;
+            default:
+                return std::is_same_v<T, bool> ? "a bool" : "an integer";
+        }
+    } else if constexpr (std::is_floating_point_v<T>) {
+        return decodeScalar(L, index, out) ? nullptr : "a float";
+    } else if constexpr (is_basic_string<T>::value) {
+        if (lua_type(L, index) != LUA_TSTRING) {
+            return "a string";
+        }
+        size_t len;
+        const char* str = lua_tolstring(L, index, &len);
+        out.assign(str, len);
+        return nullptr;
+    } else {
+        static_assert(is_string<T>::value, "tryReadScalar needs a type accepted by readsWithoutThrowing");
+        if (lua_type(L, index) != LUA_TSTRING) {
+            return "a string";
+        }
+        copyLuaString(L, index, out);
+        return nullptr;
+    }
+}
+
+// Function to read from Lua stack
 template<typename T>
 static T readFromLuaStack(lua_State* L, const char* fn, int index) {
+    // Planned scalars only reach the branches below off their fast path
+    if constexpr (scalarPlan<T>() != LuaScalarPlan::None) {
+        T value;
+        if (decodeScalar(L, index, value)) {
+            return value;
+        }
+    }
     if constexpr (std::is_same_v<T, BasicLuaType>) {
     lua_get_type(type, L, index);
     switch (type) {
@@ -277,8 +1009,11 @@ static T readFromLuaStack(lua_State* L, const char* fn, int index) {
             return lua_tonumber(L, index);
         case LUA_TBOOLEAN:
             return static_cast<bool>(lua_toboolean(L, index));
-        case LUA_TSTRING:
-            return std::string(lua_tostring(L, index));
+        case LUA_TSTRING: {
+            size_t len;
+            const char* str = lua_tolstring(L, index, &len);
+            return std::string(str, len);
+        }
         default:
             throw std::runtime_error(std::format("Unexpected non-BasicLuaType {}", fn));
     }
@@ -289,6 +1024,9 @@ static T readFromLuaStack(lua_State* L, const char* fn, int index) {
             using ValueType = typename T::value_type;
             return readFromLuaStack<ValueType>(L, fn, index);  // Read normally
         }
+    } else if constexpr (requires { { T::fromLuaStack(L, fn, index) } -> std::same_as<T>; }) {
+        // Types that decode themselves, e.g. LuaSequenceRange
+        return T::fromLuaStack(L, fn, index);
     } else if constexpr (std::is_integral_v<T>) {
         lua_get_type(type, L, index);
     switch (type) {
@@ -321,28 +1059,35 @@ static T readFromLuaStack(lua_State* L, const char* fn, int index) {
         default:
             throw std::runtime_error(std::format("Unexpected non-BasicLuaType {}, expected a float", fn));
     }
-    } else if constexpr (std::is_same_v<T, std::string>) {
+    } else if constexpr (is_basic_string<T>::value) {
+        if (lua_type(L, index) != LUA_TSTRING) {
+            throw std::runtime_error(std::format("Unexpected non-string type {}", fn));
+        }
+        size_t len;
+        const char* str = lua_tolstring(L, index, &len);
+        return T(str, len);
+    } else if constexpr (std::is_same_v<T, std::string_view> || std::is_same_v<T, std::span<const char>>) {
+        // Borrowed from the Lua string, valid while the value stays reachable
+        // (see LuaResultGuard)
         if (lua_type(L, index) != LUA_TSTRING) {
             throw std::runtime_error(std::format("Unexpected non-string type {}", fn));
         }
-        return std::string(lua_tostring(L, index));
+        size_t len;
+        const char* str = lua_tolstring(L, index, &len);
+        return T(str, len);
     } else if constexpr (is_string<T>::value) {
         if (lua_type(L, index) != LUA_TSTRING) {
             throw std::runtime_error(std::format("Unexpected non-string type {}", fn));
         }
         T result;
-        snprintf(result.data(), result.size(), "%s", lua_tostring(L, index));
+        copyLuaString(L, index, result);
         return result;
     } else if constexpr (is_string_bool_pair<T>::value) {
         if (lua_type(L, index) != LUA_TSTRING) {
             throw std::runtime_error(std::format("Unexpected non-string type {}", fn));
         }
         T result;
-        result.second = true;
-        auto spaceNeeded = snprintf(result.first.data(), result.first.size(), "%s", lua_tostring(L, index));
-        if (spaceNeeded >= result.first.size()) {
-            result.second = false;
-        }
+        result.second = copyLuaString(L, index, result.first);
         return result;
     } else if constexpr (std::is_same_v<T, bool>) {
         lua_get_type(type, L, index);
@@ -360,84 +1105,157 @@ static T readFromLuaStack(lua_State* L, const char* fn, int index) {
         default:
             throw std::runtime_error(std::format("Unexpected non-BasicLuaType {}, expected a bool", fn));
     }
-    } else if constexpr (is_vector<T>::value) {
-        if (!isList(L, index) ) {
-            throw std::runtime_error(std::format("Unexpected non-list type {}, expected a list", fn));
-        }
-        using ValueType = typename T::value_type;
+    } else if constexpr (is_sequence_container<T>::value) {
         T result;
-        luaL_checktype(L, index, LUA_TTABLE);
-        int len = lua_rawlen(L, index);
-        result.reserve(len);
-        for (int i = 1; i <= len; ++i) {
-            lua_rawgeti(L, index, i);
-            result.push_back(readFromLuaStack<ValueType>(L, fn, -1));
-            lua_pop(L, 1);
-        }
-        return std::move(result);
+        readIntoFromLuaStack(L, fn, index, result);
+        return result;
     } else if constexpr (is_array_size_pair<T>::value) {
-        if (!isList(L, index) ) {
-            throw std::runtime_error(std::format("Unexpected non-list type {}, expected a list", fn));
-        }
-
         T result;
         using ArrayType = decltype(result.first);
         using ValueType = typename ArrayType::value_type;
         constexpr size_t size = result.first.size();
-        
-        luaL_checktype(L, index, LUA_TTABLE);
-        int len = lua_rawlen(L, index);
-        for (int i = 1; i <= len; ++i) {
-            if (i > size) {
+
+        lua_Integer len = decodeList(L, fn, index, [&](lua_Integer key) {
+            if (static_cast<lua_Unsigned>(key) > size) {
                 throw std::runtime_error(std::format("Array buffer overflow {}", fn));
             }
-            lua_rawgeti(L, index, i);
-            result.first[i-1] = (readFromLuaStack<ValueType>(L, fn, -1));
-            lua_pop(L, 1);
-        }
+            result.first[key - 1] = readElement<ValueType>(L, fn, -1);
+        });
         result.second = len;
         return result;
-    } else if constexpr (is_unordered_map<T>::value) {
-        if (!isDict(L, index)) {
+    } else if constexpr (is_map_container<T>::value) {
+        T result;
+        readIntoFromLuaStack(L, fn, index, result);
+        return result;
+    } else if constexpr (is_lua_struct<T>::value) {
+        T result{};
+        readIntoFromLuaStack(L, fn, index, result);
+        return result;
+    }
+    
+    // Fallback for unsupported types
+    throw std::runtime_error("Unsupported Lua to C++ type");
+}
+
+// Read into an existing object, reusing its capacity and allocator.
+// Sequences keep their elements (nested strings and containers are
+// overwritten in place), maps are cleared and refilled, and new elements are
+// constructed with the container's allocator, so std::pmr containers built on
+// a caller's memory_resource take every allocation from it.
+// On error the object holds a partially decoded value.
+template<typename T>
+static void readIntoFromLuaStack(lua_State* L, const char* fn, int index, T& out) {
+    if constexpr (is_basic_string<T>::value) {
+        if (lua_type(L, index) != LUA_TSTRING) {
+            throw std::runtime_error(std::format("Unexpected non-string type {}", fn));
+        }
+        size_t len;
+        const char* str = lua_tolstring(L, index, &len);
+        out.assign(str, len);
+    } else if constexpr (is_optional<T>::value) {
+        if (lua_isnil(L, index)) {
+            out.reset();
+        } else {
+            if (!out) {
+                out.emplace();
+            }
+            readIntoFromLuaStack(L, fn, index, *out);
+        }
+    } else if constexpr (hasScalarElements<T>()) {
+        // Scalar elements: size once, so the loop is only a planned decode
+        // into a slot known to exist (keys never exceed the length)
+        using ValueType = typename T::value_type;
+        if (!lua_istable(L, index)) {
+            throw std::runtime_error(std::format("Unexpected non-list type {}, expected a list", fn));
+        }
+        out.resize(lua_rawlen(L, index));
+        lua_Integer len = decodeList(L, fn, index, [&](lua_Integer key) {
+            out[static_cast<size_t>(key - 1)] = readElement<ValueType>(L, fn, -1);
+        });
+        out.resize(static_cast<size_t>(len));
+    } else if constexpr (is_sequence_container<T>::value) {
+        using ValueType = typename T::value_type;
+        if constexpr (requires { out.reserve(size_t{}); }) {
+            if (lua_istable(L, index)) {
+                out.reserve(lua_rawlen(L, index));
+            }
+        }
+        lua_Integer len = decodeList(L, fn, index, [&](lua_Integer key) {
+            size_t position = static_cast<size_t>(key - 1);
+            if (position == out.size()) {
+                out.emplace_back();
+            } else if (position > out.size()) {
+                // Key from the hash part or a hole, place it by index
+                out.resize(position + 1);
+            }
+            if constexpr (readsInPlace<ValueType>()) {
+                readIntoFromLuaStack(L, fn, -1, out[position]);
+            } else {
+                out[position] = readElement<ValueType>(L, fn, -1);
+            }
+        });
+        out.resize(static_cast<size_t>(len));
+    } else if constexpr (is_map_container<T>::value) {
+        if (!lua_istable(L, index)) {
             throw std::runtime_error(std::format("Unexpected non-dict type {}, expected a dict", fn));
         }
         using KeyType = typename MapTypesExtractor<T>::key_type;
-        using MappedType = typename MapTypesExtractor<T>::mapped_type;
-    
-        // First, count the number of elements to reserve space
+        out.clear();
+
+        // Single traversal, lua_next never yields nil keys or values
         int tableIndex = lua_absindex(L, index);
         lua_pushnil(L);  // First key
-        int count = 0;
         while (lua_next(L, tableIndex) != 0) {
-            if (lua_type(L, -1) != LUA_TNIL) {
-                count++;
+            try {
+                KeyType key = makeElement<KeyType>(out);
+                readIntoFromLuaStack(L, fn, -2, key);
+                auto it = out.try_emplace(std::move(key)).first;
+                readIntoFromLuaStack(L, fn, -1, it->second);
+            } catch (...) {
+                lua_pop(L, 2);
+                throw;
             }
             lua_pop(L, 1);  // Remove value, keep key for next iteration
         }
-    
-        // Create the result map with reserved space
-        T result;
-        result.reserve(count);  // Preallocate space
-    
-        // Reset the iterator
-        lua_pushnil(L);  // First key
-        while (lua_next(L, tableIndex) != 0) {
-            if (lua_type(L, -1) != LUA_TNIL) {
-                lua_get_type(keytype, L, -2);
-                lua_get_type(valtype, L, -1);
+    } else if constexpr (is_lua_struct<T>::value) {
+        if (!lua_istable(L, index)) {
+            throw std::runtime_error(std::format("Unexpected non-table type {}, expected a struct", fn));
+        }
+        int tableIndex = lua_absindex(L, index);
+        pushStructKeys<T>(L);
+        int keysIndex = lua_gettop(L);
+        std::apply([&](const auto&... field) {
+            lua_Integer i = 0;
+            (readStructField(L, fn, tableIndex, keysIndex, ++i, field.name, out.*(field.pointer)), ...);
+        }, LuaStructTraits<T>::fields);
+        lua_pop(L, 1);  // Remove the keys table
+    } else {
+        out = readFromLuaStack<T>(L, fn, index);
+    }
+}
 
-                auto key = readFromLuaStack<KeyType>(L, fn, -2);
-                auto value = readFromLuaStack<MappedType>(L, fn, -1);
-                result[key] = value;
-            }
-            lua_pop(L, 1);  // Remove value, keep key for next iteration
+// Look up one struct field by its interned key and decode it in place
+template<typename Member>
+static void readStructField(lua_State* L, const char* fn, int tableIndex, int keysIndex, lua_Integer field, std::string_view name, Member& out) {
+    lua_rawgeti(L, keysIndex, field);
+    lua_rawget(L, tableIndex);
+    try {
+        if constexpr (readsInPlace<Member>()) {
+            readIntoFromLuaStack(L, fn, -1, out);
+        } else {
+            out = readElement<Member>(L, fn, -1);
         }
-        return std::move(result);
+    } catch (const std::exception& e) {
+        lua_settop(L, keysIndex - 1);
+        throw std::runtime_error(std::format("{} (field '{}')", e.what(), name));
     }
+    lua_pop(L, 1);
+}
 
-    
-    // Fallback for unsupported types
-    throw std::runtime_error("Unsupported Lua to C++ type");
+// Characters of a fixed-size char buffer up to its first NUL
+static std::string_view boundedString(const char* data, size_t size) {
+    std::string_view chars(data, size);
+    return chars.substr(0, chars.find('\0'));
 }
 
 // Function to push to Lua stack
@@ -458,13 +1276,28 @@ static void pushToLuaStack(lua_State* L, const T& value) {
             lua_pushnil(L);  // Push nil if the optional is empty
         }
     }
-    else if constexpr (is_unordered_map<T>::value) {
+    else if constexpr (is_lua_struct<T>::value) {
+        pushStructKeys<T>(L);
+        constexpr size_t fieldCount = std::tuple_size_v<decltype(LuaStructTraits<T>::fields)>;
+        lua_createtable(L, 0, fieldCount);
+        std::apply([&](const auto&... field) {
+            lua_Integer i = 0;
+            ((lua_rawgeti(L, -2, ++i), pushToLuaStack(L, value.*(field.pointer)), lua_rawset(L, -3)), ...);
+        }, LuaStructTraits<T>::fields);
+        lua_remove(L, -2);  // Remove the keys table
+    }
+    else if constexpr (is_map_container<T>::value) {
         lua_createtable(L, 0, value.size());
         for (const auto& [k, v] : value) {
             pushToLuaStack(L, k);
             pushToLuaStack(L, v);  // Push the value
             lua_settable(L, -3);  // Set the key-value pair in the table
         }
+    } else if constexpr (is_reference_wrapper<T>::value) {
+        pushToLuaStack(L, value.get());
+    } else if constexpr (std::is_same_v<T, bool>) {
+        // Before the integral branch, bool is integral but must stay a boolean
+        lua_pushboolean(L, value);
     } else if constexpr (std::is_integral_v<T>) {
         if constexpr (std::is_signed_v<T>) {
             lua_pushinteger(L, static_cast<lua_Integer>(value));
@@ -473,21 +1306,43 @@ static void pushToLuaStack(lua_State* L, const T& value) {
         }
     } else if constexpr (std::is_floating_point_v<T>) {
         lua_pushnumber(L, static_cast<lua_Number>(value));
-    } else if constexpr (std::is_same_v<T, std::string>) {
-        lua_pushstring(L, value.c_str());
-    } else if constexpr (std::is_same_v<T, std::string_view>) {
-        lua_pushstring(L, value.data());
-    } else if constexpr (std::is_same_v<T, const char*>) {
+    } else if constexpr (is_basic_string<T>::value || std::is_same_v<T, std::string_view> || std::is_same_v<T, std::span<const char>>) {
+        lua_pushlstring(L, value.data(), value.size());
+    } else if constexpr (std::is_same_v<T, const char*> || std::is_same_v<T, char*>) {
         lua_pushstring(L, value);
-    } else if constexpr (std::is_same_v<T, bool>) {
-        lua_pushboolean(L, value);
-    } else if constexpr (is_vector<T>::value || is_array<T>::value) {
+    } else if constexpr (std::is_array_v<T> && std::is_same_v<std::remove_cv_t<std::remove_extent_t<T>>, char>) {
+        // String literals and char buffers forwarded by reference
+        std::string_view chars = boundedString(value, std::extent_v<T>);
+        lua_pushlstring(L, chars.data(), chars.size());
+    } else if constexpr (is_string<T>::value) {
+        std::string_view chars = boundedString(value.data(), value.size());
+        lua_pushlstring(L, chars.data(), chars.size());
+    } else if constexpr (is_lua_buffer<T>::value) {
+        value.push(L);
+    } else if constexpr (requires { value.toLuaStack(L); }) {
+        // Types that push themselves, e.g. LuaView
+        value.toLuaStack(L);
+    } else if constexpr (isNumericRange<T>()) {
+        // Numeric fast path, element conversion resolved once for the whole table
+        using ValueType = std::ranges::range_value_t<T>;
+        const size_t size = std::ranges::size(value);
+        const ValueType* data = std::ranges::data(value);
+        lua_createtable(L, static_cast<int>(size), 0);
+        for (size_t i = 0; i < size; ++i) {
+            if constexpr (std::is_integral_v<ValueType>) {
+                lua_pushinteger(L, static_cast<lua_Integer>(data[i]));
+            } else {
+                lua_pushnumber(L, static_cast<lua_Number>(data[i]));
+            }
+            lua_rawseti(L, -2, static_cast<lua_Integer>(i + 1));
+        }
+    } else if constexpr (is_sequence_container<T>::value || is_array<T>::value || is_span<T>::value) {
         lua_createtable(L, value.size(), 0);
         for (size_t i = 0; i < value.size(); ++i) {
             pushToLuaStack(L, value[i]);  // Pass Lua state and value
             lua_rawseti(L, -2, i + 1);  // Set the value in the table
         }
-    } else if (is_array_size_pair<T>::value) {
+    } else if constexpr (is_array_size_pair<T>::value) {
         lua_createtable(L, value.second, 0);
         for (size_t i = 0; i < value.second; ++i) {
             pushToLuaStack(L, value.first[i]);  // Pass Lua state and value
@@ -495,7 +1350,7 @@ static void pushToLuaStack(lua_State* L, const T& value) {
         }
     }
     else {
-        throw std::runtime_error("Unsupported C++ to Lua type");
+        static_assert(!std::is_same_v<T, T>, "Unsupported C++ to Lua type");
     }
 }
 
@@ -515,81 +1370,400 @@ private:
     }
 
 public:
-    // Call a Lua function with no return value
-    template<typename... Args>
-    static void callVoid(lua_State* L, std::string_view functionName, Args... args) {
-        // Get the function from the global table
-        lua_getglobal(L, functionName.data());
+    // Push a global function by name; string_view need not be null-terminated.
+    // Returns false with the stack unchanged if it is not a function.
+    static bool tryPushFunction(lua_State* L, std::string_view functionName) {
+        lua_pushglobaltable(L);
+        lua_pushlstring(L, functionName.data(), functionName.size());
+        lua_gettable(L, -2);
+        lua_remove(L, -2);  // Remove the globals table
 
         if (!lua_isfunction(L, -1)) {
             lua_pop(L, 1);  // Remove the invalid function from the stack
-            throw std::runtime_error("Function '" + std::string(functionName) + "' is not a valid Lua function.");
+            return false;
+        }
+        return true;
+    }
+
+    // Push a function pinned by a LuaFunctionRef, no lookup needed
+    static bool tryPushFunction(lua_State* L, const LuaFunctionRef& function) {
+        if (!function) {
+            return false;
+        }
+        function.push(L);
+        return true;
+    }
+
+    template<typename Function>
+    static void pushFunction(lua_State* L, const Function& function) {
+        if (!tryPushFunction(L, function)) {
+            throw std::runtime_error("Function '" + std::string(functionName(function)) + "' is not a valid Lua function.");
+        }
+    }
+
+    static std::string_view functionName(std::string_view functionName) {
+        return functionName;
+    }
+
+    static std::string_view functionName(const LuaFunctionRef& function) {
+        return function.name();
+    }
+
+    // Wrappers such as LuaTrackedFunction forward to the function they wrap.
+    // A beforeCall hook runs first, while no argument has been pushed yet.
+    template<typename Function>
+        requires requires(const Function& f) { f.callee(); }
+    static bool tryPushFunction(lua_State* L, const Function& function) {
+        if constexpr (requires { function.beforeCall(L); }) {
+            function.beforeCall(L);
+        }
+        return tryPushFunction(L, function.callee());
+    }
+
+    template<typename Function>
+        requires requires(const Function& f) { f.callee(); }
+    static std::string_view functionName(const Function& function) {
+        return functionName(function.callee());
+    }
+
+    // Copy and pop the error value left by a failed lua_pcall
+    static std::string popError(lua_State* L) {
+        size_t len = 0;
+        const char* str = lua_tolstring(L, -1, &len);
+        std::string message = str ? std::string(str, len) : std::string("unknown error");
+        lua_pop(L, 1);
+        return message;
+    }
+
+    // Instrumentation policy of a call, chosen by the function's type
+    template<typename Function>
+    static auto instrument(const Function& function) {
+        if constexpr (requires { function.beginCall(); }) {
+            return function.beginCall();
+        } else {
+            return LuaNoInstrumentation{};
         }
+    }
+
+    // Values marshalled by a push or read, containers count their elements
+    template<typename T>
+    static size_t marshalledElements(const T& value) {
+        using U = std::remove_cvref_t<T>;
+        if constexpr (std::ranges::sized_range<const U> && !std::is_convertible_v<const U&, std::string_view> && !is_string<U>::value) {
+            return std::ranges::size(value);
+        } else {
+            return 1;
+        }
+    }
+
+    // Call a Lua function with no return value
+    template<typename Function, typename... Args>
+    static void callVoid(lua_State* L, const Function& function, Args&&... args) {
+        auto instrumentation = instrument(function);
+        pushFunction(L, function);
 
         // Push arguments
         (pushToLuaStack(L, args), ...);
+        instrumentation.pushed((marshalledElements(args) + ... + size_t(0)));
 
         // Call the function
         if (lua_pcall(L, sizeof...(Args), 0, 0) != LUA_OK) {
-            throw std::runtime_error(lua_tostring(L, -1));
+            throw std::runtime_error(popError(L));
         }
+        instrumentation.called();
+        instrumentation.finished(0);
     }
     
     // Call a Lua function with a single return value
-    template<typename ReturnType, typename... Args>
-    static ReturnType call(lua_State* L, std::string_view functionName, Args... args) {
-        // Get the function from the global table
-        lua_getglobal(L, functionName.data());
-        
-        if (!lua_isfunction(L, -1)) {
-        lua_pop(L, 1);  // Remove the invalid function from the stack
-        throw std::runtime_error("Function '" + std::string(functionName) + "' is not a valid Lua function.");
-    }
+    template<typename ReturnType, typename Function, typename... Args>
+    static ReturnType call(lua_State* L, const Function& function, Args&&... args) {
+        auto instrumentation = instrument(function);
+        pushFunction(L, function);
         
         // Push arguments
         (pushToLuaStack(L, args), ...);
+        instrumentation.pushed((marshalledElements(args) + ... + size_t(0)));
 
         // Call the function
         if (lua_pcall(L, sizeof...(Args), 1, 0) != LUA_OK) {
-            throw std::runtime_error(lua_tostring(L, -1));
+            throw std::runtime_error(popError(L));
         }
+        instrumentation.called();
 
         // Read and return the result
+        std::string_view name = functionName(function);
         char debugstr[255];
-        snprintf(debugstr, sizeof(debugstr), "returned by %s()", functionName.data());
-        ReturnType result = readFromLuaStack<ReturnType>(L, debugstr, -1);
-        lua_pop(L, 1);
+        snprintf(debugstr, sizeof(debugstr), "returned by %.*s()", static_cast<int>(name.size()), name.data());
+        ReturnType result = [&] {
+            try {
+                return readFromLuaStack<ReturnType>(L, debugstr, -1);
+            } catch (...) {
+                lua_pop(L, 1);
+                throw;
+            }
+        }();
+        if constexpr (!borrowsFromStack<ReturnType>()) {
+            lua_pop(L, 1);
+        }
+        instrumentation.finished(marshalledElements(result));
         return result;
     }
 
     // Call a Lua function with multiple return values
-    template<typename... ReturnTypes, typename... Args>
-    static std::tuple<ReturnTypes...> callMultiReturn(lua_State* L, std::string_view functionName, Args... args) {
-        // Get the function from the global table
-        lua_getglobal(L, functionName.data());
-        
-if (!lua_isfunction(L, -1)) {
-        lua_pop(L, 1);  // Remove the invalid function from the stack
-        throw std::runtime_error("Function '" + std::string(functionName) + "' is not a valid Lua function.");
-    }
-
+    template<typename... ReturnTypes, typename Function, typename... Args>
+    static std::tuple<ReturnTypes...> callMultiReturn(lua_State* L, const Function& function, Args&&... args) {
+        auto instrumentation = instrument(function);
+        pushFunction(L, function);
         
         // Push arguments
         (pushToLuaStack(L, args), ...);
+        instrumentation.pushed((marshalledElements(args) + ... + size_t(0)));
 
         // Call the function
         constexpr int numReturns = sizeof...(ReturnTypes);
         if (lua_pcall(L, sizeof...(Args), numReturns, 0) != LUA_OK) {
-            throw std::runtime_error(lua_tostring(L, -1));
+            throw std::runtime_error(popError(L));
         }
+        instrumentation.called();
 
         // Process multiple return values
+        std::string_view name = functionName(function);
+        char debugstr[255];
+        snprintf(debugstr, sizeof(debugstr), "returned by %.*s()", static_cast<int>(name.size()), name.data());
+        auto result = [&] {
+            try {
+                return processMultiReturn<ReturnTypes...>(L, debugstr, numReturns);
+            } catch (...) {
+                lua_pop(L, numReturns);
+                throw;
+            }
+        }();
+        if constexpr (!(borrowsFromStack<ReturnTypes>() || ...)) {
+            lua_pop(L, numReturns);
+        }
+        instrumentation.finished(std::apply([](const auto&... values) {
+            return (marshalledElements(values) + ... + size_t(0));
+        }, result));
+        return result;
+    }
+
+    // Call a Lua function and decode its single result into an existing object
+    template<typename ReturnType, typename Function, typename... Args>
+    static void callInto(lua_State* L, const Function& function, ReturnType& out, Args&&... args) {
+        auto instrumentation = instrument(function);
+        pushFunction(L, function);
+
+        // Push arguments
+        (pushToLuaStack(L, args), ...);
+        instrumentation.pushed((marshalledElements(args) + ... + size_t(0)));
+
+        // Call the function
+        if (lua_pcall(L, sizeof...(Args), 1, 0) != LUA_OK) {
+            throw std::runtime_error(popError(L));
+        }
+        instrumentation.called();
+
+        std::string_view name = functionName(function);
+        char debugstr[255];
+        snprintf(debugstr, sizeof(debugstr), "returned by %.*s()", static_cast<int>(name.size()), name.data());
+        try {
+            readIntoFromLuaStack(L, debugstr, -1, out);
+        } catch (...) {
+            lua_pop(L, 1);
+            throw;
+        }
+        lua_pop(L, 1);
+        instrumentation.finished(marshalledElements(out));
+    }
+
+    // Call a Lua function once per argument tuple. The function is resolved,
+    // the stack is sized and the debug string is formatted once per batch;
+    // sink(i, value) receives each result.
+    template<typename ReturnType, typename Function, typename... Args, typename Sink>
+    static void callBatch(lua_State* L, const Function& function, std::span<const std::tuple<Args...>> inputs, Sink&& sink) {
+        constexpr int numReturns = std::is_void_v<ReturnType> ? 0 : 1;
+        if (!lua_checkstack(L, sizeof...(Args) + 2)) {
+            throw std::runtime_error("Lua stack overflow");
+        }
+
+        int base = lua_gettop(L);
+        pushFunction(L, function);
+        int functionIndex = lua_gettop(L);
+
+        std::string_view name = functionName(function);
+        char debugstr[255];
+        snprintf(debugstr, sizeof(debugstr), "returned by %.*s()", static_cast<int>(name.size()), name.data());
+
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            auto instrumentation = instrument(function);
+            lua_pushvalue(L, functionIndex);
+            instrumentation.pushed(std::apply([L](const auto&... args) {
+                (pushToLuaStack(L, args), ...);
+                return (marshalledElements(args) + ... + size_t(0));
+            }, inputs[i]));
+
+            if (lua_pcall(L, sizeof...(Args), numReturns, 0) != LUA_OK) {
+                const char* error = lua_tostring(L, -1);
+                std::string message = std::format("{} (batch element {})", error ? error : "unknown error", i);
+                lua_settop(L, base);
+                throw std::runtime_error(message);
+            }
+            instrumentation.called();
+
+            if constexpr (numReturns != 0) {
+                try {
+                    ReturnType value = readFromLuaStack<ReturnType>(L, debugstr, -1);
+                    instrumentation.finished(marshalledElements(value));
+                    sink(i, std::move(value));
+                } catch (...) {
+                    lua_settop(L, base);
+                    throw;
+                }
+                lua_pop(L, 1);
+            } else {
+                instrumentation.finished(0);
+            }
+        }
+        lua_settop(L, base);
+    }
+
+    // Call a Lua function once with the whole batch as an array. Single
+    // argument tuples become plain elements, others become nested arrays.
+    // The function must return an array with one result per element.
+    template<typename ReturnType, typename Function, typename... Args>
+    static std::vector<ReturnType> callBatchTable(lua_State* L, const Function& function, std::span<const std::tuple<Args...>> inputs) {
+        if (!lua_checkstack(L, 4)) {
+            throw std::runtime_error("Lua stack overflow");
+        }
+
+        auto instrumentation = instrument(function);
+        int base = lua_gettop(L);
+        pushFunction(L, function);
+
+        lua_createtable(L, static_cast<int>(inputs.size()), 0);
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            if constexpr (sizeof...(Args) == 1) {
+                pushToLuaStack(L, std::get<0>(inputs[i]));
+            } else {
+                lua_createtable(L, sizeof...(Args), 0);
+                lua_Integer field = 1;
+                std::apply([L, &field](const auto&... args) {
+                    ((pushToLuaStack(L, args), lua_rawseti(L, -2, field++)), ...);
+                }, inputs[i]);
+            }
+            lua_rawseti(L, -2, static_cast<lua_Integer>(i + 1));
+        }
+        instrumentation.pushed(inputs.size() * sizeof...(Args));
+
+        if (lua_pcall(L, 1, 1, 0) != LUA_OK) {
+            std::string message = lua_tostring(L, -1) ? lua_tostring(L, -1) : "unknown error";
+            lua_settop(L, base);
+            throw std::runtime_error(message);
+        }
+        instrumentation.called();
+
+        std::string_view name = functionName(function);
         char debugstr[255];
-        snprintf(debugstr, sizeof(debugstr), "returned by %s()", functionName.data());
-        auto result = processMultiReturn<ReturnTypes...>(L, debugstr, numReturns);
-        lua_pop(L, numReturns);
+        snprintf(debugstr, sizeof(debugstr), "returned by %.*s()", static_cast<int>(name.size()), name.data());
+        std::vector<ReturnType> result;
+        try {
+            result = readFromLuaStack<std::vector<ReturnType>>(L, debugstr, -1);
+        } catch (...) {
+            lua_settop(L, base);
+            throw;
+        }
+        lua_settop(L, base);
+
+        if (result.size() != inputs.size()) {
+            throw std::runtime_error(std::format("Batch size mismatch {}, expected {} results, got {}", debugstr, inputs.size(), result.size()));
+        }
+        instrumentation.finished(result.size());
         return result;
     }
+
+#ifdef __cpp_lib_expected
+    // Exception-free call. Errors come back as a LuaError and the stack is
+    // restored to its previous top on every path. Scalar results are checked
+    // without throwing; containers and structs fall back to readFromLuaStack
+    // and report its message.
+    template<typename... ReturnTypes, typename Function, typename... Args>
+    static std::expected<typename LuaTryResult<ReturnTypes...>::type, LuaError> tryCall(lua_State* L, const Function& function, Args&&... args) {
+        using Result = typename LuaTryResult<ReturnTypes...>::type;
+        constexpr int numReturns = std::is_void_v<Result> ? 0 : static_cast<int>(sizeof...(ReturnTypes));
+        int base = lua_gettop(L);
+        if (!lua_checkstack(L, std::max(static_cast<int>(sizeof...(Args)) + 2, numReturns + 1))) {
+            return std::unexpected(LuaError(LuaErrorCode::StackOverflow, functionName(function)));
+        }
+
+        auto instrumentation = instrument(function);
+        lua_pushcfunction(L, &LuaError::messageHandler);
+        if (!tryPushFunction(L, function)) {
+            lua_settop(L, base);
+            return std::unexpected(LuaError(LuaErrorCode::NotAFunction, functionName(function)));
+        }
+
+        // Push arguments
+        (pushToLuaStack(L, args), ...);
+        instrumentation.pushed((marshalledElements(args) + ... + size_t(0)));
+
+        int status = lua_pcall(L, sizeof...(Args), numReturns, base + 1);
+        if (status != LUA_OK) {
+            LuaError error = LuaError::fromStack(L, status, functionName(function));
+            lua_settop(L, base);
+            return std::unexpected(std::move(error));
+        }
+        instrumentation.called();
+
+        if constexpr (std::is_void_v<Result>) {
+            lua_settop(L, base);
+            instrumentation.finished(0);
+            return {};
+        } else {
+            std::tuple<ReturnTypes...> values;
+            std::optional<LuaError> error = tryReadResults(L, base + 2, function, values, std::index_sequence_for<ReturnTypes...>{});
+            lua_settop(L, base);
+            if (error) {
+                return std::unexpected(std::move(*error));
+            }
+            instrumentation.finished(std::apply([](const auto&... value) {
+                return (marshalledElements(value) + ... + size_t(0));
+            }, values));
+            if constexpr (sizeof...(ReturnTypes) == 1) {
+                return std::move(std::get<0>(values));
+            } else {
+                return values;
+            }
+        }
+    }
+
+private:
+    // Stops at the first result that fails to convert
+    template<typename Function, typename... ReturnTypes, size_t... Is>
+    static std::optional<LuaError> tryReadResults(lua_State* L, int first, const Function& function, std::tuple<ReturnTypes...>& values, std::index_sequence<Is...>) {
+        std::optional<LuaError> error;
+        ((error = tryReadResult(L, first + static_cast<int>(Is), function, Is, std::get<Is>(values))) || ...);
+        return error;
+    }
+
+    template<typename T, typename Function>
+    static std::optional<LuaError> tryReadResult(lua_State* L, int index, const Function& function, size_t result, T& out) {
+        if constexpr (readsWithoutThrowing<T>()) {
+            if (const char* expected = tryReadScalar(L, index, out)) {
+                return LuaError::mismatch(functionName(function), result, lua_type(L, index), expected);
+            }
+        } else {
+            std::string_view name = functionName(function);
+            char debugstr[255];
+            snprintf(debugstr, sizeof(debugstr), "returned by %.*s()", static_cast<int>(name.size()), name.data());
+            try {
+                out = readFromLuaStack<T>(L, debugstr, index);
+            } catch (const std::exception& e) {
+                return LuaError(LuaErrorCode::TypeMismatch, name, e.what());
+            }
+        }
+        return std::nullopt;
+    }
+#endif
 };
 
 // Function to determine if there are multiple return types
@@ -601,21 +1775,138 @@ constexpr bool hasMultipleReturnTypes() {
 
 template<typename... ReturnTypes>
 struct is_void_only {
-    static constexpr bool value = (sizeof...(ReturnTypes) == 1 && std::is_same_v<std::tuple_element_t<0, std::tuple<ReturnTypes...>>, void>);
+    static constexpr bool value = sizeof...(ReturnTypes) == 0 || std::is_same_v<std::tuple<ReturnTypes...>, std::tuple<void>>;
 };
 
-// Unified CallLuaFunction
-template<typename... ReturnTypes, typename... Args>
-auto CallLuaFunction(lua_State* L, std::string_view functionName, Args... args) {
+// Unified CallLuaFunction, Function is a global name or a LuaFunctionRef
+template<typename... ReturnTypes, typename Function, typename... Args>
+auto CallLuaFunction(lua_State* L, const Function& function, Args&&... args) {
+    static_assert(!(LuaFunctionCaller::borrowsFromStack<ReturnTypes>() || ...),
+        "std::string_view and std::span<const char> results must be read through LuaResultGuard::call");
     if constexpr (hasMultipleReturnTypes<ReturnTypes...>()) {
-        return LuaFunctionCaller::callMultiReturn<ReturnTypes...>(L, functionName, args...);
+        return LuaFunctionCaller::callMultiReturn<ReturnTypes...>(L, function, std::forward<Args>(args)...);
     } else if constexpr (is_void_only<ReturnTypes...>::value) {
-        LuaFunctionCaller::callVoid(L, functionName, args...); // Assume this function exists
+        LuaFunctionCaller::callVoid(L, function, std::forward<Args>(args)...);
     } else {
         static_assert(sizeof...(ReturnTypes) == 1, "Must have exactly one return type if not multiple");
-        return LuaFunctionCaller::call<std::tuple_element_t<0, std::tuple<ReturnTypes...>>>(L, functionName, args...);
+        return LuaFunctionCaller::call<std::tuple_element_t<0, std::tuple<ReturnTypes...>>>(L, function, std::forward<Args>(args)...);
     }
 }
 
+// CallLuaFunction through a pinned handle, using the state it was resolved in
+template<typename... ReturnTypes, typename... Args>
+auto CallLuaFunction(const LuaFunctionRef& function, Args&&... args) {
+    return CallLuaFunction<ReturnTypes...>(function.state(), function, std::forward<Args>(args)...);
+}
+
+#ifdef __cpp_lib_expected
+// CallLuaFunction without exceptions: returns std::expected<R, LuaError>
+// (void, a single type or a tuple) and always restores the stack.
+//   auto score = TryCallLuaFunction<int>(L, "score", player);
+//   if (!score) log(score.error().message());
+template<typename... ReturnTypes, typename Function, typename... Args>
+auto TryCallLuaFunction(lua_State* L, const Function& function, Args&&... args) {
+    static_assert(!(LuaFunctionCaller::borrowsFromStack<ReturnTypes>() || ...),
+        "std::string_view and std::span<const char> results must be read through LuaResultGuard::call");
+    return LuaFunctionCaller::tryCall<ReturnTypes...>(L, function, std::forward<Args>(args)...);
+}
+
+template<typename... ReturnTypes, typename... Args>
+auto TryCallLuaFunction(const LuaFunctionRef& function, Args&&... args) {
+    return TryCallLuaFunction<ReturnTypes...>(function.state(), function, std::forward<Args>(args)...);
+}
+#endif
+
+// Keeps call results on the Lua stack until destruction, so borrowed
+// std::string_view and std::span<const char> results stay valid:
+//   LuaResultGuard guard(L);
+//   std::string_view tag = guard.call<std::string_view>("get_tag", id);
+class LuaResultGuard {
+public:
+    explicit LuaResultGuard(lua_State* L) : state_(L), top_(lua_gettop(L)) {}
+
+    LuaResultGuard(const LuaResultGuard&) = delete;
+    LuaResultGuard& operator=(const LuaResultGuard&) = delete;
+
+    ~LuaResultGuard() {
+        lua_settop(state_, top_);
+    }
+
+    template<typename... ReturnTypes, typename Function, typename... Args>
+    auto call(const Function& function, Args&&... args) {
+        static_assert(sizeof...(ReturnTypes) > 0 && !is_void_only<ReturnTypes...>::value, "LuaResultGuard::call needs a return type");
+        if constexpr (hasMultipleReturnTypes<ReturnTypes...>()) {
+            return LuaFunctionCaller::callMultiReturn<ReturnTypes...>(state_, function, std::forward<Args>(args)...);
+        } else {
+            return LuaFunctionCaller::call<ReturnTypes...>(state_, function, std::forward<Args>(args)...);
+        }
+    }
+
+    lua_State* state() const { return state_; }
+
+private:
+    lua_State* state_;
+    int top_;
+};
+
+// Decode the result into an existing object, reusing its capacity and allocator:
+//   std::pmr::vector<std::pmr::string> tags(&arena);
+//   CallLuaFunctionInto(L, "get_tags", tags, id);
+template<typename ReturnType, typename Function, typename... Args>
+void CallLuaFunctionInto(lua_State* L, const Function& function, ReturnType& out, Args&&... args) {
+    static_assert(!LuaFunctionCaller::borrowsFromStack<ReturnType>(),
+        "std::string_view and std::span<const char> results must be read through LuaResultGuard::call");
+    LuaFunctionCaller::callInto(L, function, out, std::forward<Args>(args)...);
+}
+
+enum class LuaBatchMode {
+    PerElement,  // One lua_pcall per argument tuple
+    Table        // One lua_pcall with the whole batch as an array
+};
+
+// Call one Lua function over a span of argument tuples
+template<typename ReturnType, typename Function, typename... Args>
+auto CallLuaFunctionBatch(lua_State* L, const Function& function, std::span<const std::tuple<Args...>> inputs, LuaBatchMode mode = LuaBatchMode::PerElement) {
+    static_assert(!LuaFunctionCaller::borrowsFromStack<ReturnType>(), "Batch results must own their data");
+    if constexpr (std::is_void_v<ReturnType>) {
+        if (mode == LuaBatchMode::Table) {
+            throw std::invalid_argument("LuaBatchMode::Table requires a return type");
+        }
+        LuaFunctionCaller::callBatch<void>(L, function, inputs, [](size_t, auto&&) {});
+    } else {
+        if (mode == LuaBatchMode::Table) {
+            return LuaFunctionCaller::callBatchTable<ReturnType>(L, function, inputs);
+        }
+        std::vector<ReturnType> result;
+        result.reserve(inputs.size());
+        LuaFunctionCaller::callBatch<ReturnType>(L, function, inputs, [&result](size_t, ReturnType&& value) {
+            result.push_back(std::move(value));
+        });
+        return result;
+    }
+}
+
+template<typename ReturnType, typename Function, typename... Args>
+auto CallLuaFunctionBatch(lua_State* L, const Function& function, const std::vector<std::tuple<Args...>>& inputs, LuaBatchMode mode = LuaBatchMode::PerElement) {
+    return CallLuaFunctionBatch<ReturnType>(L, function, std::span<const std::tuple<Args...>>(inputs), mode);
+}
+
+// Batch call writing into a caller-provided output span
+template<typename ReturnType, typename Function, typename... Args, typename Output>
+void CallLuaFunctionBatch(lua_State* L, const Function& function, std::span<const std::tuple<Args...>> inputs, std::span<Output> outputs) {
+    static_assert(!LuaFunctionCaller::borrowsFromStack<ReturnType>(), "Batch results must own their data");
+    if (outputs.size() < inputs.size()) {
+        throw std::invalid_argument("Batch output span is smaller than the input span");
+    }
+    LuaFunctionCaller::callBatch<ReturnType>(L, function, inputs, [outputs](size_t i, ReturnType&& value) {
+        outputs[i] = std::move(value);
+    });
+}
+
+template<typename... ReturnTypes, typename... Args>
+auto LuaFunctionRef::operator()(Args&&... args) const {
+    return CallLuaFunction<ReturnTypes...>(state_, *this, std::forward<Args>(args)...);
+}
+
 
-#endif
\ No newline at end of file
+#endif
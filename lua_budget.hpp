@@ -0,0 +1,375 @@
+#ifndef LUA_LUABUDGET
+#define LUA_LUABUDGET
+
+#include "lua_bindings.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Limits of one budgeted call. Zero disables a limit; with both disabled
+// no hook is installed and the call costs the same as CallLuaFunction.
+struct LuaBudget {
+    uint64_t instructions = 0;
+    std::chrono::nanoseconds timeout{0};
+    // VM instructions between checks: lower is tighter, higher is cheaper
+    int granularity = 1000;
+    class LuaBudgetStats* stats = nullptr;
+};
+
+enum class LuaBudgetLimit {
+    Instructions,
+    Deadline,
+};
+
+// Thrown by CallLuaFunctionWithBudget when the script ran out of budget.
+// The state is left usable: the stack is restored and the hook removed.
+class LuaBudgetExceeded : public std::runtime_error {
+public:
+    LuaBudgetExceeded(const std::string& message, LuaBudgetLimit limit, uint64_t instructions, std::chrono::nanoseconds elapsed)
+        : std::runtime_error(message), limit_(limit), instructions_(instructions), elapsed_(elapsed) {}
+
+    LuaBudgetLimit limit() const { return limit_; }
+    uint64_t instructions() const { return instructions_; }
+    std::chrono::nanoseconds elapsed() const { return elapsed_; }
+
+private:
+    LuaBudgetLimit limit_;
+    uint64_t instructions_;
+    std::chrono::nanoseconds elapsed_;
+};
+
+// How much of their budget calls use, as a share of the tightest limit.
+// May be shared by calls on several threads.
+class LuaBudgetStats {
+public:
+    // Bucket i counts calls using up to (i + 1) * 10% of the budget, the last one overruns
+    static constexpr size_t kUsageBuckets = 11;
+
+    struct Snapshot {
+        uint64_t calls = 0;
+        uint64_t exceeded = 0;
+        double peakUsage = 0;  // 1.0 is the whole budget
+        std::array<uint64_t, kUsageBuckets> usage = {};
+    };
+
+    void record(double usage, bool exceeded) {
+        size_t bucket = exceeded ? kUsageBuckets - 1 : std::min<size_t>(static_cast<size_t>(usage * 10), kUsageBuckets - 2);
+        calls_.fetch_add(1, std::memory_order_relaxed);
+        if (exceeded) {
+            exceeded_.fetch_add(1, std::memory_order_relaxed);
+        }
+        usage_[bucket].fetch_add(1, std::memory_order_relaxed);
+        uint64_t permille = static_cast<uint64_t>(usage * 1000);
+        uint64_t peak = peakPermille_.load(std::memory_order_relaxed);
+        while (permille > peak && !peakPermille_.compare_exchange_weak(peak, permille, std::memory_order_relaxed)) {
+        }
+    }
+
+    Snapshot snapshot() const {
+        Snapshot snapshot;
+        snapshot.calls = calls_.load(std::memory_order_relaxed);
+        snapshot.exceeded = exceeded_.load(std::memory_order_relaxed);
+        snapshot.peakUsage = static_cast<double>(peakPermille_.load(std::memory_order_relaxed)) / 1000;
+        for (size_t i = 0; i < kUsageBuckets; ++i) {
+            snapshot.usage[i] = usage_[i].load(std::memory_order_relaxed);
+        }
+        return snapshot;
+    }
+
+private:
+    std::atomic<uint64_t> calls_{0};
+    std::atomic<uint64_t> exceeded_{0};
+    std::atomic<uint64_t> peakPermille_{0};
+    std::array<std::atomic<uint64_t>, kUsageBuckets> usage_{};
+};
+
+// Enforces a LuaBudget on the calls made on L during its lifetime through a
+// LUA_MASKCOUNT hook. The hook raises a Lua error once a limit is hit and
+// then fires on every instruction, so a script catching the error with
+// pcall is stopped at its next instruction. Coroutines share the budget:
+// those created meanwhile inherit the hook, and older ones are hooked when
+// they are resumed, through coroutine.resume and coroutine.wrap wrappers
+// the guard puts into the coroutine library for its lifetime. A script that
+// saved coroutine.resume or made coroutine.wrap functions before the guard
+// bypasses these; installCoroutineWrappers() covers that case. Guards nest;
+// an inner guard replaces the outer one (and any other hook) until it is
+// destroyed.
+class LuaBudgetGuard {
+public:
+    LuaBudgetGuard(lua_State* L, const LuaBudget& budget)
+        : state_(L), budget_(budget), start_(Clock::now()) {
+        if (budget.instructions == 0 && budget.timeout.count() <= 0) {
+            return;
+        }
+        deadline_ = budget.timeout.count() > 0 ? start_ + budget.timeout : Clock::time_point::max();
+        uint64_t granularity = static_cast<uint64_t>(std::max(budget.granularity, 1));
+        if (budget.instructions > 0) {
+            granularity = std::min(granularity, budget.instructions);
+        }
+        step_ = static_cast<int>(granularity);
+
+        previousHook_ = lua_gethook(L);
+        previousMask_ = lua_gethookmask(L);
+        previousCount_ = lua_gethookcount(L);
+        lua_rawgetp(L, LUA_REGISTRYINDEX, &kActiveKey);
+        previous_ = lua_touserdata(L, -1);
+        lua_pop(L, 1);
+        lua_pushlightuserdata(L, this);
+        lua_rawsetp(L, LUA_REGISTRYINDEX, &kActiveKey);
+        lua_sethook(L, &hook, kHookMask, step_);
+        active_ = true;
+        wrappedCoroutines_ = wrapCoroutines(L);
+    }
+
+    LuaBudgetGuard(const LuaBudgetGuard&) = delete;
+    LuaBudgetGuard& operator=(const LuaBudgetGuard&) = delete;
+
+    ~LuaBudgetGuard() {
+        if (wrappedCoroutines_) {
+            unwrapCoroutines(state_);
+        }
+        if (active_) {
+            if (previous_) {
+                lua_pushlightuserdata(state_, previous_);
+            } else {
+                lua_pushnil(state_);
+            }
+            lua_rawsetp(state_, LUA_REGISTRYINDEX, &kActiveKey);
+            lua_sethook(state_, previousHook_, previousMask_, previousCount_);
+        }
+        if (budget_.stats) {
+            budget_.stats->record(usage(), exceeded_);
+        }
+    }
+
+    bool exceeded() const { return exceeded_; }
+    LuaBudgetLimit limit() const { return limit_; }
+
+    // Counted at the check granularity
+    uint64_t instructions() const { return instructions_; }
+
+    std::chrono::nanoseconds elapsed() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start_);
+    }
+
+    // Share of the tightest limit used so far
+    double usage() const {
+        double used = 0;
+        if (budget_.instructions > 0) {
+            used = static_cast<double>(instructions_) / static_cast<double>(budget_.instructions);
+        }
+        if (budget_.timeout.count() > 0) {
+            used = std::max(used, static_cast<double>(elapsed().count()) / static_cast<double>(budget_.timeout.count()));
+        }
+        return used;
+    }
+
+    // Puts the coroutine.resume and coroutine.wrap wrappers in place for
+    // good, so that resume references a script saves and wrap functions it
+    // makes at load time are budgeted too. Call once after opening the
+    // libraries; outside a guard a wrapper only adds a registry lookup.
+    static void installCoroutineWrappers(lua_State* L) {
+        wrapCoroutines(L);
+    }
+
+    [[noreturn]] void raise() const {
+        std::chrono::nanoseconds spent = elapsed();
+        const char* what = limit_ == LuaBudgetLimit::Instructions ? "instruction" : "time";
+        throw LuaBudgetExceeded(std::format("Lua {} budget exceeded after {} instructions and {}us", what, instructions_, spent.count() / 1000), limit_, instructions_, spent);
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    static inline const char kActiveKey = 0;
+    static constexpr int kHookMask = LUA_MASKCOUNT;
+
+    // No C++ object may be alive when luaL_error unwinds out of here
+    static void hook(lua_State* L, lua_Debug*) {
+        lua_rawgetp(L, LUA_REGISTRYINDEX, &kActiveKey);
+        auto* guard = static_cast<LuaBudgetGuard*>(lua_touserdata(L, -1));
+        lua_pop(L, 1);
+        if (!guard) {
+            // A coroutine that outlived its budgeted call
+            lua_sethook(L, nullptr, 0, 0);
+            return;
+        }
+        if (!guard->exceeded_) {
+            guard->instructions_ += static_cast<uint64_t>(guard->step_);
+            if (guard->budget_.instructions > 0 && guard->instructions_ >= guard->budget_.instructions) {
+                guard->limit_ = LuaBudgetLimit::Instructions;
+            } else if (Clock::now() >= guard->deadline_) {
+                guard->limit_ = LuaBudgetLimit::Deadline;
+            } else {
+                return;
+            }
+            guard->exceeded_ = true;
+        }
+        lua_sethook(L, &hook, kHookMask, 1);
+        luaL_error(L, "execution budget exceeded");
+    }
+
+    // Hooks the thread at index if a guard is active and it has no hook
+    // yet, i.e. it was created before the guard. A thread hooked once no
+    // guard is active unhooks itself at its first count event.
+    static void budgetThread(lua_State* L, int index) {
+        if (lua_type(L, index) != LUA_TTHREAD) {
+            return;
+        }
+        lua_State* thread = lua_tothread(L, index);
+        lua_rawgetp(L, LUA_REGISTRYINDEX, &kActiveKey);
+        auto* guard = static_cast<LuaBudgetGuard*>(lua_touserdata(L, -1));
+        lua_pop(L, 1);
+        if (guard && lua_gethook(thread) != &hook) {
+            lua_sethook(thread, &hook, kHookMask, guard->exceeded_ ? 1 : guard->step_);
+        }
+    }
+
+    // Calls the function at upvalue 1 with the arguments, returning all results
+    static int forward(lua_State* L) {
+        lua_pushvalue(L, lua_upvalueindex(1));
+        lua_insert(L, 1);
+        lua_call(L, lua_gettop(L) - 1, LUA_MULTRET);
+        return lua_gettop(L);
+    }
+
+    // coroutine.resume, upvalue 1 is the original
+    static int resume(lua_State* L) {
+        budgetThread(L, 1);
+        return forward(L);
+    }
+
+    // coroutine.wrap, upvalue 1 is the original; the function it makes keeps
+    // its thread as upvalue 1
+    static int wrap(lua_State* L) {
+        forward(L);
+        lua_settop(L, 1);
+        lua_pushcclosure(L, &callWrapped, 1);
+        return 1;
+    }
+
+    static int callWrapped(lua_State* L) {
+        if (lua_getupvalue(L, lua_upvalueindex(1), 1)) {
+            budgetThread(L, -1);
+            lua_pop(L, 1);
+        }
+        return forward(L);
+    }
+
+    // Replaces coroutine.resume and coroutine.wrap in the loaded coroutine
+    // library, unless it is missing or already wrapped
+    static bool wrapCoroutines(lua_State* L) {
+        if (!pushCoroutineLibrary(L)) {
+            return false;
+        }
+        bool wrappedResume = replace(L, "resume", &resume);
+        bool wrapped = replace(L, "wrap", &wrap) || wrappedResume;
+        lua_pop(L, 1);
+        return wrapped;
+    }
+
+    // Puts the originals back where the wrappers are still in place
+    static void unwrapCoroutines(lua_State* L) {
+        if (!pushCoroutineLibrary(L)) {
+            return;
+        }
+        for (const char* name : {"resume", "wrap"}) {
+            lua_pushstring(L, name);
+            lua_pushvalue(L, -1);
+            lua_rawget(L, -3);
+            if (lua_tocfunction(L, -1) == (name[0] == 'r' ? &resume : &wrap)) {
+                lua_getupvalue(L, -1, 1);
+                lua_replace(L, -2);
+                lua_rawset(L, -3);
+            } else {
+                lua_pop(L, 2);
+            }
+        }
+        lua_pop(L, 1);
+    }
+
+    static bool pushCoroutineLibrary(lua_State* L) {
+        lua_getfield(L, LUA_REGISTRYINDEX, LUA_LOADED_TABLE);
+        if (lua_istable(L, -1)) {
+            lua_pushliteral(L, LUA_COLIBNAME);
+            lua_rawget(L, -2);
+            lua_remove(L, -2);
+        }
+        if (!lua_istable(L, -1)) {
+            lua_pop(L, 1);
+            return false;
+        }
+        return true;
+    }
+
+    // Wraps the function field name of the table on top in a closure of
+    // wrapper, false if it is not a function or already wrapped
+    static bool replace(lua_State* L, const char* name, lua_CFunction wrapper) {
+        lua_pushstring(L, name);
+        lua_pushvalue(L, -1);
+        lua_rawget(L, -3);
+        if (!lua_isfunction(L, -1) || lua_tocfunction(L, -1) == wrapper) {
+            lua_pop(L, 2);
+            return false;
+        }
+        lua_pushcclosure(L, wrapper, 1);
+        lua_rawset(L, -3);
+        return true;
+    }
+
+    lua_State* state_;
+    LuaBudget budget_;
+    Clock::time_point start_;
+    Clock::time_point deadline_ = Clock::time_point::max();
+    int step_ = 0;
+    uint64_t instructions_ = 0;
+    bool active_ = false;
+    bool wrappedCoroutines_ = false;
+    bool exceeded_ = false;
+    LuaBudgetLimit limit_ = LuaBudgetLimit::Instructions;
+    void* previous_ = nullptr;
+    lua_Hook previousHook_ = nullptr;
+    int previousMask_ = 0;
+    int previousCount_ = 0;
+};
+
+// CallLuaFunction with hard limits, for scripts that cannot be trusted to
+// terminate:
+//   LuaBudget budget{.instructions = 1'000'000, .timeout = 5ms, .stats = &stats};
+//   bool allowed = CallLuaFunctionWithBudget<bool>(L, budget, "rule", request);
+// Throws LuaBudgetExceeded on overrun, other errors as CallLuaFunction does.
+// A call that returns after an overrun (a coroutine ran out of budget and
+// the script returned resume's false) also throws.
+template<typename... ReturnTypes, typename Function, typename... Args>
+auto CallLuaFunctionWithBudget(lua_State* L, const LuaBudget& budget, const Function& function, Args&&... args) {
+    LuaBudgetGuard guard(L, budget);
+    try {
+        if constexpr (std::is_void_v<decltype(CallLuaFunction<ReturnTypes...>(L, function, std::forward<Args>(args)...))>) {
+            CallLuaFunction<ReturnTypes...>(L, function, std::forward<Args>(args)...);
+            if (guard.exceeded()) {
+                guard.raise();
+            }
+        } else {
+            auto result = CallLuaFunction<ReturnTypes...>(L, function, std::forward<Args>(args)...);
+            if (guard.exceeded()) {
+                guard.raise();
+            }
+            return result;
+        }
+    } catch (const LuaBudgetExceeded&) {
+        throw;
+    } catch (const std::runtime_error&) {
+        if (guard.exceeded()) {
+            guard.raise();
+        }
+        throw;
+    }
+}
+
+template<typename... ReturnTypes, typename... Args>
+auto CallLuaFunctionWithBudget(const LuaFunctionRef& function, const LuaBudget& budget, Args&&... args) {
+    return CallLuaFunctionWithBudget<ReturnTypes...>(function.state(), budget, function, std::forward<Args>(args)...);
+}
+
+#endif
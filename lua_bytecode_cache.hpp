@@ -0,0 +1,200 @@
+#ifndef LUA_LUABYTECODECACHE
+#define LUA_LUABYTECODECACHE
+
+#include "lua_bindings.hpp"
+#include "lua_mapped_file.hpp"
+#include <atomic>
+#include <filesystem>
+#include <initializer_list>
+
+// Functions exported by a script run through LuaBytecodeCache::run, pinned
+// as handles in the state the script ran in
+class LuaScript {
+public:
+    explicit LuaScript(bool fromCache) : fromCache_(fromCache) {}
+
+    const LuaFunctionRef& function(std::string_view name) const {
+        auto it = functions_.find(std::string(name));
+        if (it == functions_.end()) {
+            throw std::runtime_error("Script does not export function '" + std::string(name) + "'");
+        }
+        return it->second;
+    }
+
+    const std::unordered_map<std::string, LuaFunctionRef>& functions() const { return functions_; }
+
+    // True if the chunk was loaded from cached bytecode instead of compiled
+    bool fromCache() const { return fromCache_; }
+
+    void add(LuaFunctionRef function) {
+        std::string name = function.name();
+        functions_.insert_or_assign(std::move(name), std::move(function));
+    }
+
+private:
+    std::unordered_map<std::string, LuaFunctionRef> functions_;
+    bool fromCache_;
+};
+
+// Compiles Lua sources once and keeps their lua_dump output on disk, keyed by
+// a hash of the source, chunk name and Lua version. Later loads map the
+// cached file and hand it straight to lua_load, skipping the parser. Lua does
+// not verify bytecode and may crash on a damaged chunk, so every entry starts
+// with its key and a checksum of the bytecode; entries that do not match
+// (truncated, corrupt, another source) are recompiled and replaced. This
+// guards against accidents, not against anyone who can write the directory.
+//   LuaBytecodeCache cache("/var/cache/app/lua");
+//   LuaScript script = cache.run(L, source, "=main", {"update", "render"});
+//   CallLuaFunction<void>(script.function("update"), dt);
+// Safe to share between threads; files are written atomically.
+class LuaBytecodeCache {
+public:
+    // strip drops debug information (line numbers, local names) from the bytecode
+    explicit LuaBytecodeCache(std::filesystem::path directory, bool strip = false)
+        : directory_(std::move(directory)), strip_(strip) {
+        std::error_code ec;
+        std::filesystem::create_directories(directory_, ec);
+    }
+
+    // Push the compiled chunk onto the stack; returns true on a cache hit
+    bool load(lua_State* L, std::string_view source, std::string_view chunkName = "=script") {
+        uint64_t key = keyFor(source, chunkName);
+        std::filesystem::path path = pathFor(key);
+        std::string name(chunkName);
+        {
+            LuaMappedFile file(path);
+            if (std::string_view bytecode; file && verify(std::string_view(file.data(), file.size()), key, bytecode)) {
+                if (luaL_loadbufferx(L, bytecode.data(), bytecode.size(), name.c_str(), "b") == LUA_OK) {
+                    hits_.fetch_add(1, std::memory_order_relaxed);
+                    return true;
+                }
+                lua_pop(L, 1);  // Stale entry, recompile below
+            }
+        }
+
+        if (luaL_loadbufferx(L, source.data(), source.size(), name.c_str(), "t") != LUA_OK) {
+            std::string message = lua_tostring(L, -1) ? lua_tostring(L, -1) : "unknown error";
+            lua_pop(L, 1);
+            throw std::runtime_error(message);
+        }
+        std::string entry(kHeaderSize, '\0');
+        lua_dump(L, &appendChunk, &entry, strip_);
+        uint64_t checksum = hash(key, std::string_view(entry).substr(kHeaderSize));
+        std::memcpy(entry.data(), &key, sizeof(key));
+        std::memcpy(entry.data() + sizeof(key), &checksum, sizeof(checksum));
+        WriteLuaFileAtomically(path, entry);
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    // Load and run the chunk, then pin its exported functions. A chunk that
+    // returns a table exports that table's functions (all of them when
+    // exports is empty); otherwise exports name global functions.
+    LuaScript run(lua_State* L, std::string_view source, std::string_view chunkName = "=script", std::initializer_list<std::string_view> exports = {}) {
+        int base = lua_gettop(L);
+        LuaScript script(load(L, source, chunkName));
+        if (lua_pcall(L, 0, 1, 0) != LUA_OK) {
+            std::string message = lua_tostring(L, -1) ? lua_tostring(L, -1) : "unknown error";
+            lua_settop(L, base);
+            throw std::runtime_error(message);
+        }
+
+        try {
+            if (lua_istable(L, -1) && exports.size() == 0) {
+                lua_pushnil(L);
+                while (lua_next(L, -2) != 0) {
+                    if (lua_type(L, -2) == LUA_TSTRING && lua_isfunction(L, -1)) {
+                        size_t len;
+                        const char* key = lua_tolstring(L, -2, &len);
+                        script.add(LuaFunctionRef::fromStack(L, std::string_view(key, len)));
+                    } else {
+                        lua_pop(L, 1);
+                    }
+                }
+            } else if (lua_istable(L, -1)) {
+                for (std::string_view name : exports) {
+                    lua_pushlstring(L, name.data(), name.size());
+                    lua_gettable(L, -2);
+                    script.add(LuaFunctionRef::fromStack(L, name));
+                }
+            } else {
+                for (std::string_view name : exports) {
+                    script.add(LuaFunctionRef(L, name));
+                }
+            }
+        } catch (...) {
+            lua_settop(L, base);
+            throw;
+        }
+        lua_settop(L, base);
+        return script;
+    }
+
+    // Compiled bytecode of source, e.g. as the init chunk of a LuaStatePool
+    std::string bytecode(std::string_view source, std::string_view chunkName = "=script") {
+        std::unique_ptr<lua_State, decltype(&lua_close)> state(luaL_newstate(), &lua_close);
+        if (!state) {
+            throw std::runtime_error("Failed to create lua_State");
+        }
+        load(state.get(), source, chunkName);
+        std::string result;
+        lua_dump(state.get(), &appendChunk, &result, strip_);
+        return result;
+    }
+
+    std::filesystem::path pathFor(std::string_view source, std::string_view chunkName) const {
+        return pathFor(keyFor(source, chunkName));
+    }
+
+    size_t hits() const { return hits_.load(std::memory_order_relaxed); }
+    size_t misses() const { return misses_.load(std::memory_order_relaxed); }
+
+private:
+    // Entry header: the key and a checksum over key and bytecode
+    static constexpr size_t kHeaderSize = 2 * sizeof(uint64_t);
+
+    // FNV-1a
+    static uint64_t hash(uint64_t hash, std::string_view bytes) {
+        for (char c : bytes) {
+            hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+    // Hash of everything that changes the dumped bytecode
+    uint64_t keyFor(std::string_view source, std::string_view chunkName) const {
+        uint64_t key = hash(14695981039346656037ull, source);
+        key = hash(key, std::string_view("\0", 1));
+        key = hash(key, chunkName);
+        return hash(key, std::format("\n{}:{}:{}:{}", LUA_VERSION_NUM, sizeof(lua_Integer), sizeof(lua_Number), strip_ ? 1 : 0));
+    }
+
+    std::filesystem::path pathFor(uint64_t key) const {
+        return directory_ / std::format("{:016x}.luac", key);
+    }
+
+    // The bytecode of an entry whose header matches key and contents
+    static bool verify(std::string_view entry, uint64_t key, std::string_view& bytecode) {
+        if (entry.size() <= kHeaderSize) {
+            return false;
+        }
+        uint64_t storedKey;
+        uint64_t storedChecksum;
+        std::memcpy(&storedKey, entry.data(), sizeof(storedKey));
+        std::memcpy(&storedChecksum, entry.data() + sizeof(storedKey), sizeof(storedChecksum));
+        bytecode = entry.substr(kHeaderSize);
+        return storedKey == key && storedChecksum == hash(key, bytecode);
+    }
+
+    static int appendChunk(lua_State*, const void* p, size_t size, void* ud) {
+        static_cast<std::string*>(ud)->append(static_cast<const char*>(p), size);
+        return 0;
+    }
+
+    std::filesystem::path directory_;
+    bool strip_;
+    std::atomic<size_t> hits_{0};
+    std::atomic<size_t> misses_{0};
+};
+
+#endif
@@ -0,0 +1,358 @@
+#ifndef LUA_LUACALLPROFILER
+#define LUA_LUACALLPROFILER
+
+#include "lua_bindings.hpp"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <unordered_set>
+
+template<typename Callee>
+class LuaTrackedFunction;
+
+// Per-function call statistics: call and error counts, a latency histogram,
+// time spent pushing arguments, inside lua_pcall and reading results, and the
+// number of values marshalled. Calls are recorded by passing a tracked
+// function instead of a name or handle:
+//   LuaCallProfiler profiler;
+//   auto score = profiler.track("score");
+//   int r = CallLuaFunction<int>(L, score, player);
+//   std::string metrics = profiler.prometheus();
+// Untracked calls are not instrumented at all. Each thread records into its
+// own counters without locking; snapshots merge them on demand.
+class LuaCallProfiler {
+public:
+    // Bucket i counts calls up to 256ns << i, the last bucket is unbounded
+    static constexpr size_t kLatencyBuckets = 24;
+
+    struct Stats {
+        std::string function;
+        uint64_t calls = 0;
+        uint64_t errors = 0;
+        uint64_t pushNanos = 0;
+        uint64_t callNanos = 0;
+        uint64_t readNanos = 0;
+        uint64_t totalNanos = 0;
+        uint64_t elements = 0;  // Arguments and results, containers count their elements
+        std::array<uint64_t, kLatencyBuckets> latency = {};
+    };
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // Written by one thread only, relaxed loads from snapshot()
+    struct Counters {
+        std::atomic<uint64_t> calls{0};
+        std::atomic<uint64_t> errors{0};
+        std::atomic<uint64_t> pushNanos{0};
+        std::atomic<uint64_t> callNanos{0};
+        std::atomic<uint64_t> readNanos{0};
+        std::atomic<uint64_t> totalNanos{0};
+        std::atomic<uint64_t> elements{0};
+        std::array<std::atomic<uint64_t>, kLatencyBuckets> latency{};
+    };
+
+    struct Shard {
+        std::mutex mutex;  // Held while the owner grows counters and during snapshots
+        std::deque<Counters> counters;  // Indexed by slot, references stay valid on growth
+    };
+
+    static void bump(std::atomic<uint64_t>& counter, uint64_t delta) {
+        counter.store(counter.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+
+public:
+    // Records one call; a scope destroyed before finished() counts as an error
+    class Scope {
+    public:
+        explicit Scope(Counters& counters) : counters_(counters), start_(Clock::now()), mark_(start_) {}
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+        ~Scope() {
+            Clock::time_point end = finished_ ? mark_ : Clock::now();
+            uint64_t total = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start_).count());
+            size_t bucket = std::min<size_t>(std::bit_width(total >> 8), kLatencyBuckets - 1);
+            bump(counters_.calls, 1);
+            if (!finished_) {
+                bump(counters_.errors, 1);
+            }
+            bump(counters_.totalNanos, total);
+            bump(counters_.elements, elements_);
+            bump(counters_.latency[bucket], 1);
+        }
+
+        void pushed(size_t elements) {
+            elements_ += elements;
+            lap(counters_.pushNanos);
+        }
+
+        void called() {
+            lap(counters_.callNanos);
+        }
+
+        void finished(size_t elements) {
+            elements_ += elements;
+            lap(counters_.readNanos);
+            finished_ = true;
+        }
+
+    private:
+        void lap(std::atomic<uint64_t>& phase) {
+            Clock::time_point now = Clock::now();
+            bump(phase, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - mark_).count()));
+            mark_ = now;
+        }
+
+        Counters& counters_;
+        Clock::time_point start_;
+        Clock::time_point mark_;
+        size_t elements_ = 0;
+        bool finished_ = false;
+    };
+
+    LuaCallProfiler() {
+        Registry& registry = LuaCallProfiler::registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        id_ = registry.nextId++;
+        registry.live.insert(id_);
+    }
+
+    ~LuaCallProfiler() {
+        Registry& registry = LuaCallProfiler::registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.live.erase(id_);
+        registry.generation.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    LuaCallProfiler(const LuaCallProfiler&) = delete;
+    LuaCallProfiler& operator=(const LuaCallProfiler&) = delete;
+
+    // Track a global function by name, or a handle that must outlive the result.
+    // Keep the tracked function around: creating one takes a lock.
+    LuaTrackedFunction<std::string> track(std::string_view name);
+    LuaTrackedFunction<const LuaFunctionRef*> track(const LuaFunctionRef& function);
+
+    Scope beginCall(size_t slot) {
+        Shard& shard = localShard();
+        if (slot >= shard.counters.size()) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            while (shard.counters.size() <= slot) {
+                shard.counters.emplace_back();
+            }
+        }
+        return Scope(shard.counters[slot]);
+    }
+
+    // Merged counters of every thread, one entry per tracked function
+    std::vector<Stats> snapshot() const {
+        std::vector<Stats> result;
+        {
+            std::lock_guard<std::mutex> lock(slotsMutex_);
+            result.resize(slotNames_.size());
+            for (size_t slot = 0; slot < slotNames_.size(); ++slot) {
+                result[slot].function = slotNames_[slot];
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(shardsMutex_);
+        for (const auto& shard : shards_) {
+            std::lock_guard<std::mutex> shardLock(shard->mutex);
+            for (size_t slot = 0; slot < shard->counters.size() && slot < result.size(); ++slot) {
+                const Counters& counters = shard->counters[slot];
+                Stats& stats = result[slot];
+                stats.calls += counters.calls.load(std::memory_order_relaxed);
+                stats.errors += counters.errors.load(std::memory_order_relaxed);
+                stats.pushNanos += counters.pushNanos.load(std::memory_order_relaxed);
+                stats.callNanos += counters.callNanos.load(std::memory_order_relaxed);
+                stats.readNanos += counters.readNanos.load(std::memory_order_relaxed);
+                stats.totalNanos += counters.totalNanos.load(std::memory_order_relaxed);
+                stats.elements += counters.elements.load(std::memory_order_relaxed);
+                for (size_t bucket = 0; bucket < kLatencyBuckets; ++bucket) {
+                    stats.latency[bucket] += counters.latency[bucket].load(std::memory_order_relaxed);
+                }
+            }
+        }
+        return result;
+    }
+
+    // Prometheus text exposition format
+    std::string prometheus() const {
+        std::vector<Stats> stats = snapshot();
+        std::string out;
+        auto counter = [&](const char* metric, const char* help, auto value) {
+            out += std::format("# HELP {} {}\n# TYPE {} counter\n", metric, help, metric);
+            for (const Stats& s : stats) {
+                out += std::format("{}{{function=\"{}\"}} {}\n", metric, escape(s.function), value(s));
+            }
+        };
+        counter("lua_call_total", "Calls per Lua function.", [](const Stats& s) { return s.calls; });
+        counter("lua_call_errors_total", "Calls that raised an error.", [](const Stats& s) { return s.errors; });
+        counter("lua_call_marshalled_elements_total", "Values pushed and read, containers count their elements.", [](const Stats& s) { return s.elements; });
+
+        out += "# HELP lua_call_phase_seconds_total Time spent per call phase.\n# TYPE lua_call_phase_seconds_total counter\n";
+        for (const Stats& s : stats) {
+            std::string name = escape(s.function);
+            out += std::format("lua_call_phase_seconds_total{{function=\"{}\",phase=\"push\"}} {}\n", name, s.pushNanos / 1e9);
+            out += std::format("lua_call_phase_seconds_total{{function=\"{}\",phase=\"pcall\"}} {}\n", name, s.callNanos / 1e9);
+            out += std::format("lua_call_phase_seconds_total{{function=\"{}\",phase=\"read\"}} {}\n", name, s.readNanos / 1e9);
+        }
+
+        out += "# HELP lua_call_duration_seconds Call latency.\n# TYPE lua_call_duration_seconds histogram\n";
+        for (const Stats& s : stats) {
+            std::string name = escape(s.function);
+            uint64_t cumulative = 0;
+            for (size_t bucket = 0; bucket + 1 < kLatencyBuckets; ++bucket) {
+                cumulative += s.latency[bucket];
+                out += std::format("lua_call_duration_seconds_bucket{{function=\"{}\",le=\"{}\"}} {}\n", name, bucketLimit(bucket) / 1e9, cumulative);
+            }
+            out += std::format("lua_call_duration_seconds_bucket{{function=\"{}\",le=\"+Inf\"}} {}\n", name, s.calls);
+            out += std::format("lua_call_duration_seconds_sum{{function=\"{}\"}} {}\n", name, s.totalNanos / 1e9);
+            out += std::format("lua_call_duration_seconds_count{{function=\"{}\"}} {}\n", name, s.calls);
+        }
+        return out;
+    }
+
+    // JSON array, one object per function; latency maps bucket limits in ns to counts
+    std::string json() const {
+        std::vector<Stats> stats = snapshot();
+        std::string out = "[";
+        for (size_t i = 0; i < stats.size(); ++i) {
+            const Stats& s = stats[i];
+            out += std::format("{}\n  {{\"function\": \"{}\", \"calls\": {}, \"errors\": {}, \"push_ns\": {}, \"pcall_ns\": {}, \"read_ns\": {}, \"total_ns\": {}, \"elements\": {}, \"latency\": {{",
+                i == 0 ? "" : ",", escape(s.function), s.calls, s.errors, s.pushNanos, s.callNanos, s.readNanos, s.totalNanos, s.elements);
+            for (size_t bucket = 0; bucket < kLatencyBuckets; ++bucket) {
+                std::string limit = bucket + 1 < kLatencyBuckets ? std::to_string(bucketLimit(bucket)) : "+Inf";
+                out += std::format("{}\"{}\": {}", bucket == 0 ? "" : ", ", limit, s.latency[bucket]);
+            }
+            out += "}}";
+        }
+        out += stats.empty() ? "]\n" : "\n]\n";
+        return out;
+    }
+
+private:
+    // Ids of the live profilers; generation counts destroyed ones, so
+    // threads know when their shard lists hold stale entries
+    struct Registry {
+        std::mutex mutex;
+        uint64_t nextId = 0;
+        std::unordered_set<uint64_t> live;
+        std::atomic<uint64_t> generation{0};
+    };
+
+    static Registry& registry() {
+        static Registry registry;
+        return registry;
+    }
+
+    static uint64_t bucketLimit(size_t bucket) {
+        return uint64_t(256) << bucket;
+    }
+
+    // Quotes, backslashes and newlines, the escapes shared by both formats
+    static std::string escape(std::string_view text) {
+        std::string result;
+        result.reserve(text.size());
+        for (char c : text) {
+            if (c == '"' || c == '\\') {
+                result += '\\';
+                result += c;
+            } else if (c == '\n') {
+                result += "\\n";
+            } else {
+                result += c;
+            }
+        }
+        return result;
+    }
+
+    size_t slotFor(std::string_view name) {
+        std::lock_guard<std::mutex> lock(slotsMutex_);
+        auto it = slots_.find(std::string(name));
+        if (it != slots_.end()) {
+            return it->second;
+        }
+        slotNames_.emplace_back(name);
+        return slots_.emplace(std::string(name), slotNames_.size() - 1).first->second;
+    }
+
+    // Shards of this thread by profiler id, so a new profiler at a freed
+    // address never picks up a stale shard. Entries of destroyed profilers
+    // are dropped at the next lookup after a destruction.
+    struct LocalShards {
+        std::vector<std::pair<uint64_t, Shard*>> shards;
+        uint64_t generation = 0;
+    };
+
+    Shard& localShard() {
+        thread_local LocalShards localShards;
+        if (localShards.generation != registry().generation.load(std::memory_order_relaxed)) {
+            Registry& registry = LuaCallProfiler::registry();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            std::erase_if(localShards.shards, [&registry](const auto& entry) { return !registry.live.contains(entry.first); });
+            localShards.generation = registry.generation.load(std::memory_order_relaxed);
+        }
+        for (const auto& [id, shard] : localShards.shards) {
+            if (id == id_) {
+                return *shard;
+            }
+        }
+        auto shard = std::make_unique<Shard>();
+        Shard* result = shard.get();
+        {
+            std::lock_guard<std::mutex> lock(shardsMutex_);
+            shards_.push_back(std::move(shard));
+        }
+        localShards.shards.emplace_back(id_, result);
+        return *result;
+    }
+
+    uint64_t id_ = 0;
+    mutable std::mutex slotsMutex_;
+    std::unordered_map<std::string, size_t> slots_;
+    std::vector<std::string> slotNames_;
+    mutable std::mutex shardsMutex_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+};
+
+// A function name or handle whose calls are recorded by a LuaCallProfiler.
+// Accepted anywhere CallLuaFunction takes a function.
+template<typename Callee>
+class LuaTrackedFunction {
+public:
+    LuaTrackedFunction(LuaCallProfiler& profiler, size_t slot, Callee callee)
+        : profiler_(&profiler), slot_(slot), callee_(std::move(callee)) {}
+
+    decltype(auto) callee() const {
+        if constexpr (std::is_pointer_v<Callee>) {
+            return static_cast<const LuaFunctionRef&>(*callee_);
+        } else {
+            return std::string_view(callee_);
+        }
+    }
+
+    LuaCallProfiler::Scope beginCall() const {
+        return profiler_->beginCall(slot_);
+    }
+
+private:
+    LuaCallProfiler* profiler_;
+    size_t slot_;
+    Callee callee_;
+};
+
+inline LuaTrackedFunction<std::string> LuaCallProfiler::track(std::string_view name) {
+    return LuaTrackedFunction<std::string>(*this, slotFor(name), std::string(name));
+}
+
+inline LuaTrackedFunction<const LuaFunctionRef*> LuaCallProfiler::track(const LuaFunctionRef& function) {
+    return LuaTrackedFunction<const LuaFunctionRef*>(*this, slotFor(function.name()), &function);
+}
+
+#endif
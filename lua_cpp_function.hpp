@@ -0,0 +1,281 @@
+#ifndef LUA_LUACPPFUNCTION
+#define LUA_LUACPPFUNCTION
+
+#include "lua_bindings.hpp"
+#include <cstddef>
+#include <new>
+
+// Parameter and result types of a free function, member function or
+// non-generic callable
+template<typename T>
+struct LuaCppSignature : LuaCppSignature<decltype(&T::operator())> {};
+
+template<typename R, typename... Args>
+struct LuaCppSignature<R(*)(Args...)> {
+    using Result = R;
+    using Arguments = std::tuple<Args...>;
+};
+
+template<typename R, typename... Args>
+struct LuaCppSignature<R(*)(Args...) noexcept> : LuaCppSignature<R(*)(Args...)> {};
+
+#define LUA_CPP_MEMBER_SIGNATURE(qualifiers) \
+template<typename R, typename C, typename... Args> \
+struct LuaCppSignature<R(C::*)(Args...) qualifiers> : LuaCppSignature<R(*)(Args...)> {};
+LUA_CPP_MEMBER_SIGNATURE()
+LUA_CPP_MEMBER_SIGNATURE(const)
+LUA_CPP_MEMBER_SIGNATURE(noexcept)
+LUA_CPP_MEMBER_SIGNATURE(const noexcept)
+LUA_CPP_MEMBER_SIGNATURE(&)
+LUA_CPP_MEMBER_SIGNATURE(const&)
+#undef LUA_CPP_MEMBER_SIGNATURE
+
+// Generates lua_CFunction trampolines for C++ callables. The callable is
+// stored by value in a userdata upvalue (nothing at all for captureless
+// lambdas) and invoked directly, so there is no type erasure per call.
+// Arguments are decoded with readFromLuaStack, a leading lua_State*
+// parameter receives the calling state, and results are pushed with
+// pushToLuaStack (a std::tuple returns several values). Decoding errors
+// raise "bad argument #n to 'name'"; exceptions thrown by the callable
+// become Lua errors. No C++ object is alive when lua_error unwinds.
+class LuaCppFunction {
+    friend class LuaAsync;  // Reuses the argument decoding for async functions
+
+public:
+    template<typename Callable>
+    static void push(lua_State* L, Callable&& callable) {
+        using F = std::decay_t<Callable>;
+        using Signature = LuaCppSignature<F>;
+        if constexpr (std::is_empty_v<F> && std::is_default_constructible_v<F>) {
+            lua_pushcfunction(L, (&trampoline<F, Signature>));
+        } else {
+            store<F>(L, std::forward<Callable>(callable));
+            lua_pushcclosure(L, (&trampoline<F, Signature>), 1);
+        }
+    }
+
+    // Member function bound to an object that must outlive the Lua function
+    template<typename Method, typename Object>
+    static void push(lua_State* L, Method method, Object* object) {
+        static_assert(std::is_member_function_pointer_v<Method>, "Expected a member function pointer");
+        using F = Member<Method, Object>;
+        store<F>(L, F{method, object});
+        lua_pushcclosure(L, (&trampoline<F, LuaCppSignature<Method>>), 1);
+    }
+
+    // Function known at compile time, no upvalue at all
+    template<auto Function>
+    static void push(lua_State* L) {
+        using F = Constant<Function>;
+        lua_pushcfunction(L, (&trampoline<F, LuaCppSignature<decltype(Function)>>));
+    }
+
+private:
+    template<typename Method, typename Object>
+    struct Member {
+        Method method;
+        Object* object;
+
+        template<typename... Args>
+        decltype(auto) operator()(Args&&... args) const {
+            return std::invoke(method, object, std::forward<Args>(args)...);
+        }
+    };
+
+    template<auto Function>
+    struct Constant {
+        template<typename... Args>
+        decltype(auto) operator()(Args&&... args) const {
+            return std::invoke(Function, std::forward<Args>(args)...);
+        }
+    };
+
+    template<typename T>
+    struct is_tuple : std::false_type {};
+
+    template<typename... Ts>
+    struct is_tuple<std::tuple<Ts...>> : std::true_type {};
+
+    // Decoded argument storage; references bind to a decoded value
+    template<typename Arg>
+    using Stored = std::decay_t<Arg>;
+
+    // Moves into by-value parameters, lvalues for reference parameters
+    template<typename Arg>
+    using Passed = std::conditional_t<std::is_reference_v<Arg>, Arg, std::decay_t<Arg>&&>;
+
+    // Userdata holding a callable. __gc sets destroyed, so a call or a
+    // second __gc reached through debug.getmetatable finds it gone.
+    template<typename F>
+    struct Box {
+        F callable;
+        bool destroyed = false;
+    };
+
+    // One __gc metatable per callable type, cached under this address
+    template<typename F>
+    static inline const char kMetatableKey = 0;
+
+    template<typename F, typename Value>
+    static void store(lua_State* L, Value&& value) {
+        static_assert(alignof(Box<F>) <= alignof(std::max_align_t), "Over-aligned callables are not supported");
+        void* memory = lua_newuserdata(L, sizeof(Box<F>));
+        new (memory) Box<F>{F(std::forward<Value>(value))};
+        if constexpr (!std::is_trivially_destructible_v<F>) {
+            if (lua_rawgetp(L, LUA_REGISTRYINDEX, &kMetatableKey<F>) == LUA_TNIL) {
+                lua_pop(L, 1);
+                lua_createtable(L, 0, 2);
+                lua_pushliteral(L, "C++ function");
+                lua_setfield(L, -2, "__metatable");  // getmetatable() cannot reach __gc
+                lua_pushcfunction(L, &destroy<F>);
+                lua_setfield(L, -2, "__gc");
+                lua_pushvalue(L, -1);
+                lua_rawsetp(L, LUA_REGISTRYINDEX, &kMetatableKey<F>);
+            }
+            lua_setmetatable(L, -2);
+        }
+    }
+
+    template<typename F>
+    static int destroy(lua_State* L) {
+        auto* box = static_cast<Box<F>*>(CheckLuaUserdata(L, 1, &kMetatableKey<F>, "C++ function"));
+        if (!box->destroyed) {
+            box->destroyed = true;
+            box->callable.~F();
+        }
+        return 0;
+    }
+
+    // The callable of the running closure, stateless ones need no userdata
+    template<typename F>
+    static F& callable(lua_State* L) {
+        if constexpr (std::is_empty_v<F> && std::is_default_constructible_v<F>) {
+            static F stateless{};
+            return stateless;
+        } else {
+            auto* box = static_cast<Box<F>*>(lua_touserdata(L, lua_upvalueindex(1)));
+            if (box->destroyed) {
+                throw std::runtime_error("C++ function called after it was destroyed");
+            }
+            return box->callable;
+        }
+    }
+
+    template<typename F, typename Signature>
+    static int trampoline(lua_State* L) {
+        int results = invoke<F, typename Signature::Result>(L, std::type_identity<typename Signature::Arguments>{});
+        if (results < 0) {
+            return lua_error(L);  // Message pushed by invoke, its locals are gone
+        }
+        return results;
+    }
+
+    // Number of results, or -1 with the error message pushed
+    template<typename F, typename Result, typename... Args>
+    static int invoke(lua_State* L, std::type_identity<std::tuple<Args...>>) {
+        int argument = 0;
+        try {
+            F* f = &callable<F>(L);
+
+            // Braced initialization decodes left to right
+            std::tuple<Stored<Args>...> values{readArgument<Args>(L, argument)...};
+            argument = 0;
+            return std::apply([&](auto&... value) {
+                if constexpr (std::is_void_v<Result>) {
+                    (*f)(static_cast<Passed<Args>>(value)...);
+                    return 0;
+                } else {
+                    return pushResult(L, (*f)(static_cast<Passed<Args>>(value)...));
+                }
+            }, values);
+        } catch (const std::exception& e) {
+            pushError(L, argument, e.what());
+        } catch (...) {
+            pushError(L, argument, "unknown C++ exception");
+        }
+        return -1;
+    }
+
+    template<typename Arg>
+    static Stored<Arg> readArgument(lua_State* L, int& argument) {
+        if constexpr (std::is_same_v<Stored<Arg>, lua_State*>) {
+            return L;
+        } else {
+            ++argument;
+            return LuaFunctionCaller::readFromLuaStack<Stored<Arg>>(L, "passed to C++", argument);
+        }
+    }
+
+    template<typename Result>
+    static int pushResult(lua_State* L, Result&& result) {
+        using R = std::remove_cvref_t<Result>;
+        if constexpr (is_tuple<R>::value) {
+            std::apply([L](const auto&... value) {
+                (LuaFunctionCaller::pushToLuaStack(L, value), ...);
+            }, result);
+            return static_cast<int>(std::tuple_size_v<R>);
+        } else {
+            LuaFunctionCaller::pushToLuaStack(L, result);
+            return 1;
+        }
+    }
+
+    // Error message with the position of the Lua caller
+    static void pushError(lua_State* L, int argument, const char* what) {
+        luaL_where(L, 1);
+        if (argument > 0) {
+            lua_Debug ar;
+            const char* name = "?";
+            if (lua_getstack(L, 0, &ar) && lua_getinfo(L, "n", &ar) && ar.name) {
+                name = ar.name;
+            }
+            lua_pushfstring(L, "bad argument #%d to '%s' (%s)", argument, name, what);
+        } else {
+            lua_pushstring(L, what);
+        }
+        lua_concat(L, 2);
+    }
+};
+
+// Push a C++ callable as a Lua function value
+template<typename Callable>
+void PushCppFunction(lua_State* L, Callable&& callable) {
+    LuaCppFunction::push(L, std::forward<Callable>(callable));
+}
+
+// Register a C++ callable as the global function name:
+//   RegisterCppFunction(L, "distance", &distance);
+//   RegisterCppFunction(L, "log", [&logger](std::string_view line) { logger.write(line); });
+template<typename Callable>
+void RegisterCppFunction(lua_State* L, std::string_view name, Callable&& callable) {
+    lua_pushglobaltable(L);
+    lua_pushlstring(L, name.data(), name.size());
+    LuaCppFunction::push(L, std::forward<Callable>(callable));
+    lua_settable(L, -3);
+    lua_pop(L, 1);
+}
+
+// Register a member function bound to object:
+//   RegisterCppFunction(L, "spawn", &World::spawn, &world);
+template<typename Method, typename Object>
+    requires std::is_member_function_pointer_v<Method>
+void RegisterCppFunction(lua_State* L, std::string_view name, Method method, Object* object) {
+    lua_pushglobaltable(L);
+    lua_pushlstring(L, name.data(), name.size());
+    LuaCppFunction::push(L, method, object);
+    lua_settable(L, -3);
+    lua_pop(L, 1);
+}
+
+// Register a function known at compile time, without any upvalue:
+//   RegisterCppFunction<&distance>(L, "distance");
+template<auto Function>
+void RegisterCppFunction(lua_State* L, std::string_view name) {
+    lua_pushglobaltable(L);
+    lua_pushlstring(L, name.data(), name.size());
+    LuaCppFunction::push<Function>(L);
+    lua_settable(L, -3);
+    lua_pop(L, 1);
+}
+
+#endif
@@ -0,0 +1,246 @@
+#ifndef LUA_LUAGCPOLICY
+#define LUA_LUAGCPOLICY
+
+#include "lua_bindings.hpp"
+#include "lua_allocator.hpp"
+#include <chrono>
+#include <cstdint>
+
+enum class LuaGcMode {
+    Incremental,
+    Generational,  // Lua 5.4 only
+};
+
+// Collector parameters; zero keeps Lua's default for that parameter
+struct LuaGcSettings {
+    LuaGcMode mode = LuaGcMode::Incremental;
+    int pause = 0;            // Incremental: % growth before a cycle starts
+    int stepMultiplier = 0;   // Incremental: work per allocated KB
+    int stepSize = 0;         // Incremental: log2 bytes allocated between steps
+    int minorMultiplier = 0;  // Generational: % growth before a minor collection
+    int majorMultiplier = 0;  // Generational: % growth before a major collection
+    // Once memory grew this much since the last finished idle cycle, the
+    // next critical section starts with a full collection, 0 for no limit.
+    // Checked when a call starts: growth inside one call is not bounded.
+    size_t suspendLimit = size_t(64) << 20;
+};
+
+inline void SetLuaGcMode(lua_State* L, const LuaGcSettings& settings) {
+#if LUA_VERSION_NUM >= 504
+    if (settings.mode == LuaGcMode::Generational) {
+        lua_gc(L, LUA_GCGEN, settings.minorMultiplier, settings.majorMultiplier);
+    } else {
+        lua_gc(L, LUA_GCINC, settings.pause, settings.stepMultiplier, settings.stepSize);
+    }
+#else
+    if (settings.mode == LuaGcMode::Generational) {
+        throw std::runtime_error("Generational garbage collection requires Lua 5.4");
+    }
+    if (settings.pause > 0) {
+        lua_gc(L, LUA_GCSETPAUSE, settings.pause);
+    }
+    if (settings.stepMultiplier > 0) {
+        lua_gc(L, LUA_GCSETSTEPMUL, settings.stepMultiplier);
+    }
+#endif
+}
+
+// Bytes in use by the state, as counted by the collector
+inline size_t GetLuaGcBytes(lua_State* L) {
+    return static_cast<size_t>(lua_gc(L, LUA_GCCOUNT, 0)) * 1024 + static_cast<size_t>(lua_gc(L, LUA_GCCOUNTB, 0));
+}
+
+struct LuaGcStepResult {
+    int steps = 0;
+    bool cycleFinished = false;
+    int64_t freedBytes = 0;  // Negative when finalizers allocated more than was swept
+    std::chrono::nanoseconds elapsed{0};
+};
+
+// Run incremental collector steps until a cycle finishes or budget is
+// spent, e.g. in an idle window or between batches. Each step does stepKb
+// worth of work (0 for one basic step), so a step may overrun the budget;
+// smaller steps give a tighter bound. Works while the collector is stopped.
+// In generational mode a step is a whole minor collection, so exactly one
+// is run and it counts as a finished cycle. Lua cannot report its mode
+// without switching it, so the caller passes the mode it set.
+inline LuaGcStepResult StepLuaGc(lua_State* L, LuaGcMode mode, std::chrono::nanoseconds budget, int stepKb = 0) {
+    using Clock = std::chrono::steady_clock;
+    LuaGcStepResult result;
+    Clock::time_point start = Clock::now();
+    Clock::time_point deadline = start + budget;
+    size_t before = GetLuaGcBytes(L);
+    Clock::time_point now = start;
+    do {
+        result.cycleFinished = lua_gc(L, LUA_GCSTEP, stepKb) != 0 || mode == LuaGcMode::Generational;
+        ++result.steps;
+        now = Clock::now();
+    } while (!result.cycleFinished && now < deadline);
+    result.freedBytes = static_cast<int64_t>(before) - static_cast<int64_t>(GetLuaGcBytes(L));
+    result.elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - start);
+    return result;
+}
+
+// Holds the collector off for its lifetime; restarts it only if it was
+// running before, so pauses nest.
+class LuaGcPause {
+public:
+    explicit LuaGcPause(lua_State* L) : state_(L), wasRunning_(lua_gc(L, LUA_GCISRUNNING, 0) != 0) {
+        if (wasRunning_) {
+            lua_gc(L, LUA_GCSTOP, 0);
+        }
+    }
+
+    LuaGcPause(const LuaGcPause&) = delete;
+    LuaGcPause& operator=(const LuaGcPause&) = delete;
+
+    ~LuaGcPause() {
+        if (wasRunning_) {
+            lua_gc(state_, LUA_GCRESTART, 0);
+        }
+    }
+
+private:
+    lua_State* state_;
+    bool wasRunning_;
+};
+
+// Garbage collection of one call
+struct LuaGcReport {
+    int64_t memoryDelta = 0;  // Bytes in use after the call minus before
+    size_t memoryAfter = 0;
+    bool suspended = false;   // The collector was held off during the call
+    bool collected = false;   // A full collection ran first, suspendLimit was reached
+    // Pooled states only (NewPooledLuaState): blocks allocated and freed,
+    // the frees being the collector's work during the call
+    size_t allocations = 0;
+    size_t frees = 0;
+};
+
+// Collector policy of one state: latency-critical calls run with the
+// collector suspended, and the garbage they leave is collected by idle()
+// between them.
+//   LuaGcPolicy gc(L, {.mode = LuaGcMode::Generational});
+//   auto reply = gc.call<Reply>("handle", request);  // no GC pause inside
+//   gc.idle(200us);                                  // pay the debt when idle
+// Without idle() calls, memory grows until suspendLimit is reached; the
+// next call then pays the whole debt with a full collection before it
+// starts. The limit is only checked between calls, so memory may exceed
+// it by what a single call allocates.
+class LuaGcPolicy {
+public:
+    struct Stats {
+        uint64_t calls = 0;
+        uint64_t suspendedCalls = 0;
+        uint64_t limitCollections = 0;  // Full collections at suspendLimit
+        int64_t maxCallGrowth = 0;
+        uint64_t idleSteps = 0;
+        uint64_t idleCycles = 0;
+        int64_t idleFreedBytes = 0;
+        std::chrono::nanoseconds idleTime{0};
+    };
+
+    explicit LuaGcPolicy(lua_State* L, const LuaGcSettings& settings = {})
+        : state_(L), settings_(settings), allocator_(GetLuaPoolAllocator(L)) {
+        SetLuaGcMode(L, settings);
+        baseline_ = GetLuaGcBytes(L);
+    }
+
+    LuaGcPolicy(const LuaGcPolicy&) = delete;
+    LuaGcPolicy& operator=(const LuaGcPolicy&) = delete;
+
+    // CallLuaFunction as a critical section; see lastCall() for its report
+    template<typename... ReturnTypes, typename Function, typename... Args>
+    auto call(const Function& function, Args&&... args) {
+        Section section(*this);
+        return CallLuaFunction<ReturnTypes...>(state_, function, std::forward<Args>(args)...);
+    }
+
+    // Bounded collector work, see StepLuaGc
+    LuaGcStepResult idle(std::chrono::nanoseconds budget, int stepKb = 0) {
+        LuaGcStepResult result = StepLuaGc(state_, settings_.mode, budget, stepKb);
+        stats_.idleSteps += static_cast<uint64_t>(result.steps);
+        stats_.idleCycles += result.cycleFinished ? 1 : 0;
+        stats_.idleFreedBytes += result.freedBytes;
+        stats_.idleTime += result.elapsed;
+        if (result.cycleFinished) {
+            baseline_ = GetLuaGcBytes(state_);
+        }
+        return result;
+    }
+
+    // A full collection, e.g. after loading scripts
+    void collect() {
+        lua_gc(state_, LUA_GCCOLLECT, 0);
+        baseline_ = GetLuaGcBytes(state_);
+    }
+
+    const LuaGcReport& lastCall() const { return lastCall_; }
+    const Stats& stats() const { return stats_; }
+    lua_State* state() const { return state_; }
+
+private:
+    // Pays the debt first if it reached suspendLimit, suspends the collector
+    // and fills lastCall_ on exit
+    class Section {
+    public:
+        explicit Section(LuaGcPolicy& policy)
+            : policy_(policy), before_(GetLuaGcBytes(policy.state_)) {
+            lua_State* L = policy.state_;
+            size_t limit = policy.settings_.suspendLimit;
+            suspended_ = lua_gc(L, LUA_GCISRUNNING, 0) != 0;
+            if (suspended_) {
+                if (limit > 0 && before_ >= policy.baseline_ + limit) {
+                    policy.collect();
+                    collected_ = true;
+                    before_ = GetLuaGcBytes(L);
+                }
+                lua_gc(L, LUA_GCSTOP, 0);
+            }
+            if (policy.allocator_) {
+                memory_ = policy.allocator_->stats();
+            }
+        }
+
+        Section(const Section&) = delete;
+        Section& operator=(const Section&) = delete;
+
+        ~Section() {
+            lua_State* L = policy_.state_;
+            LuaGcReport& report = policy_.lastCall_;
+            if (suspended_) {
+                lua_gc(L, LUA_GCRESTART, 0);
+            }
+            report.memoryAfter = GetLuaGcBytes(L);
+            report.memoryDelta = static_cast<int64_t>(report.memoryAfter) - static_cast<int64_t>(before_);
+            report.suspended = suspended_;
+            report.collected = collected_;
+            if (policy_.allocator_) {
+                LuaMemoryStats after = policy_.allocator_->stats();
+                report.allocations = after.allocations - memory_.allocations;
+                report.frees = after.frees - memory_.frees;
+            }
+            Stats& stats = policy_.stats_;
+            ++stats.calls;
+            stats.suspendedCalls += suspended_ ? 1 : 0;
+            stats.limitCollections += collected_ ? 1 : 0;
+            stats.maxCallGrowth = std::max(stats.maxCallGrowth, report.memoryDelta);
+        }
+
+    private:
+        LuaGcPolicy& policy_;
+        size_t before_;
+        bool suspended_ = false;
+        bool collected_ = false;
+        LuaMemoryStats memory_;
+    };
+
+    lua_State* state_;
+    LuaGcSettings settings_;
+    LuaPoolAllocator* allocator_;
+    size_t baseline_ = 0;
+    LuaGcReport lastCall_;
+    Stats stats_;
+};
+
+#endif
@@ -0,0 +1,259 @@
+#ifndef LUA_LUAHOTRELOAD
+#define LUA_LUAHOTRELOAD
+
+#include "lua_bindings.hpp"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+// Publishes new versions of a script to one or more running states.
+// reload() compiles on the calling thread (a deploy or control thread, never
+// the one running the state) and returns immediately. Each state swaps at
+// its next safe point: poll() called while no Lua function is running, which
+// LuaReloadableFunction does before every call and LuaStatePool does before
+// every task. A call therefore runs entirely on the old or the new version.
+//
+// A swap runs the new chunk in a sandbox whose reads fall through to the
+// current globals. Only when it finishes without error are its globals
+// copied over the old ones, and every registry reference to a replaced
+// function (LuaFunctionRef, LuaScript, ...) is re-pointed to the new one.
+// Globals listed in preserve keep their current value. Functions the new
+// version no longer defines are left in place.
+//   LuaHotReloader reloader;
+//   LuaReloadableFunction<int> update(reloader, L, "update");
+//   reloader.reload(newSource, "=game", {"world"});   // from any thread
+//   update(dt);                                        // swaps, then calls
+class LuaHotReloader {
+public:
+    LuaHotReloader() = default;
+    LuaHotReloader(const LuaHotReloader&) = delete;
+    LuaHotReloader& operator=(const LuaHotReloader&) = delete;
+
+    // Compile source (or bytecode) and publish it; returns the new version.
+    // Syntax errors throw here and leave the running version untouched.
+    uint64_t reload(std::string_view source, std::string_view chunkName = "=reload", std::vector<std::string> preserve = {}) {
+        std::unique_ptr<lua_State, decltype(&lua_close)> scratch(luaL_newstate(), &lua_close);
+        if (!scratch) {
+            throw std::runtime_error("Failed to create lua_State");
+        }
+        auto version = std::make_shared<Version>();
+        version->chunkName = chunkName;
+        version->preserve = std::move(preserve);
+        if (luaL_loadbufferx(scratch.get(), source.data(), source.size(), version->chunkName.c_str(), "bt") != LUA_OK) {
+            throw std::runtime_error(lua_tostring(scratch.get(), -1) ? lua_tostring(scratch.get(), -1) : "unknown error");
+        }
+        lua_dump(scratch.get(), &appendChunk, &version->bytecode, 0);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        version->id = ++lastId_;
+        latest_ = std::move(version);
+        version_.store(lastId_, std::memory_order_release);
+        return lastId_;
+    }
+
+    // Latest published version, 0 before the first reload
+    uint64_t version() const {
+        return version_.load(std::memory_order_acquire);
+    }
+
+    // Version L is running, 0 for its original script
+    uint64_t appliedVersion(lua_State* L) const {
+        lua_rawgetp(L, LUA_REGISTRYINDEX, this);
+        uint64_t applied = static_cast<uint64_t>(lua_tointeger(L, -1));
+        lua_pop(L, 1);
+        return applied;
+    }
+
+    // Swap L to the latest version if it is at a safe point. Returns the
+    // version L runs afterwards. A version whose chunk fails is skipped and
+    // its error kept in lastError(); L keeps running the old one.
+    uint64_t poll(lua_State* L) {
+        uint64_t applied = appliedVersion(L);
+        if (applied == version()) {
+            return applied;
+        }
+        lua_Debug ar;
+        if (lua_getstack(L, 0, &ar)) {
+            return applied;  // Called from inside Lua, not between calls
+        }
+
+        std::shared_ptr<const Version> next;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            next = latest_;
+        }
+        std::string error = apply(L, *next);
+        if (!error.empty()) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            lastError_ = std::format("Reload to version {} failed: {}", next->id, error);
+        }
+        lua_pushinteger(L, static_cast<lua_Integer>(next->id));
+        lua_rawsetp(L, LUA_REGISTRYINDEX, this);
+        return next->id;
+    }
+
+    std::string lastError() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return lastError_;
+    }
+
+private:
+    struct Version {
+        uint64_t id = 0;
+        std::string bytecode;
+        std::string chunkName;
+        std::vector<std::string> preserve;
+    };
+
+    static constexpr int kMaxReplaceDepth = 4;
+
+    static int appendChunk(lua_State*, const void* p, size_t size, void* ud) {
+        static_cast<std::string*>(ud)->append(static_cast<const char*>(p), size);
+        return 0;
+    }
+
+    // Returns the error message, empty on success; the stack is restored
+    static std::string apply(lua_State* L, const Version& version) {
+        int base = lua_gettop(L);
+        if (luaL_loadbufferx(L, version.bytecode.data(), version.bytecode.size(), version.chunkName.c_str(), "b") != LUA_OK) {
+            std::string error = lua_tostring(L, -1) ? lua_tostring(L, -1) : "unknown error";
+            lua_settop(L, base);
+            return error;
+        }
+        int chunk = lua_gettop(L);
+
+        // Sandbox: reads fall through to the current globals, writes stay here
+        lua_newtable(L);
+        int env = lua_gettop(L);
+        lua_createtable(L, 0, 1);
+        lua_pushglobaltable(L);
+        lua_setfield(L, -2, "__index");
+        lua_setmetatable(L, env);
+
+        // _ENV is the chunk's first upvalue, shared by every closure it creates
+        lua_pushvalue(L, env);
+        lua_setupvalue(L, chunk, 1);
+        lua_pushvalue(L, chunk);
+        if (lua_pcall(L, 0, 0, 0) != LUA_OK) {
+            std::string error = lua_tostring(L, -1) ? lua_tostring(L, -1) : "unknown error";
+            lua_settop(L, base);
+            return error;
+        }
+
+        lua_pushglobaltable(L);
+        int globals = lua_gettop(L);
+        lua_newtable(L);
+        int replaced = lua_gettop(L);  // Old function -> new function
+
+        lua_pushnil(L);
+        while (lua_next(L, env) != 0) {
+            if (isPreserved(L, version, globals)) {
+                lua_pop(L, 1);
+                continue;
+            }
+            lua_pushvalue(L, -2);
+            lua_rawget(L, globals);
+            mapReplaced(L, lua_gettop(L), lua_gettop(L) - 1, replaced, 0);
+            lua_pop(L, 1);
+            lua_pushvalue(L, -2);
+            lua_insert(L, -2);
+            lua_rawset(L, globals);
+        }
+
+        // New closures now see the real globals directly
+        lua_pushvalue(L, globals);
+        lua_setupvalue(L, chunk, 1);
+
+        // Re-point registry references (function handles) to the new versions
+        lua_pushnil(L);
+        while (lua_next(L, LUA_REGISTRYINDEX) != 0) {
+            if (lua_type(L, -1) == LUA_TFUNCTION) {
+                lua_rawget(L, replaced);
+                if (!lua_isnil(L, -1)) {
+                    lua_pushvalue(L, -2);
+                    lua_insert(L, -2);
+                    lua_rawset(L, LUA_REGISTRYINDEX);
+                    continue;
+                }
+            }
+            lua_pop(L, 1);
+        }
+
+        lua_settop(L, base);
+        return {};
+    }
+
+    // Key at -2 is a preserved global that already has a value
+    static bool isPreserved(lua_State* L, const Version& version, int globals) {
+        if (version.preserve.empty() || lua_type(L, -2) != LUA_TSTRING) {
+            return false;
+        }
+        size_t len;
+        const char* key = lua_tolstring(L, -2, &len);
+        if (std::find(version.preserve.begin(), version.preserve.end(), std::string_view(key, len)) == version.preserve.end()) {
+            return false;
+        }
+        lua_pushvalue(L, -2);
+        lua_rawget(L, globals);
+        bool present = !lua_isnil(L, -1);
+        lua_pop(L, 1);
+        return present;
+    }
+
+    // Record old -> new for functions found at the same path, descending
+    // into tables such as modules
+    static void mapReplaced(lua_State* L, int oldValue, int newValue, int replaced, int depth) {
+        if (lua_rawequal(L, oldValue, newValue)) {
+            return;
+        }
+        if (lua_type(L, oldValue) == LUA_TFUNCTION && lua_type(L, newValue) == LUA_TFUNCTION) {
+            lua_pushvalue(L, oldValue);
+            lua_pushvalue(L, newValue);
+            lua_rawset(L, replaced);
+        } else if (lua_istable(L, oldValue) && lua_istable(L, newValue) && depth < kMaxReplaceDepth) {
+            lua_pushnil(L);
+            while (lua_next(L, newValue) != 0) {
+                lua_pushvalue(L, -2);
+                lua_rawget(L, oldValue);
+                mapReplaced(L, lua_gettop(L), lua_gettop(L) - 1, replaced, depth + 1);
+                lua_pop(L, 2);
+            }
+        }
+    }
+
+    mutable std::mutex mutex_;
+    std::shared_ptr<const Version> latest_;
+    std::atomic<uint64_t> version_{0};
+    uint64_t lastId_ = 0;
+    std::string lastError_;
+};
+
+// Function handle that picks up published versions before each call
+template<typename... ReturnTypes>
+class LuaReloadableFunction {
+public:
+    LuaReloadableFunction(LuaHotReloader& reloader, lua_State* L, std::string_view path)
+        : reloader_(&reloader), function_(L, path), seen_(reloader.appliedVersion(L)) {}
+
+    const LuaFunctionRef& callee() const { return function_; }
+
+    // Safe point hook run by LuaFunctionCaller before the function is pushed
+    void beforeCall(lua_State* L) const {
+        if (reloader_->version() != seen_) {
+            seen_ = reloader_->poll(L);
+        }
+    }
+
+    template<typename... Args>
+    auto operator()(Args&&... args) const {
+        return CallLuaFunction<ReturnTypes...>(function_.state(), *this, std::forward<Args>(args)...);
+    }
+
+private:
+    LuaHotReloader* reloader_;
+    LuaFunctionRef function_;
+    mutable uint64_t seen_;
+};
+
+#endif
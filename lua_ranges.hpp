@@ -0,0 +1,349 @@
+#ifndef LUA_LUARANGES
+#define LUA_LUARANGES
+
+#include "lua_bindings.hpp"
+#include <cstddef>
+#include <iterator>
+
+// Any Lua value pinned in the registry; move-only, must not outlive its state
+class LuaRegistryRef {
+public:
+    LuaRegistryRef() = default;
+
+    // Pin the value at index
+    LuaRegistryRef(lua_State* L, int index) : state_(L) {
+        lua_pushvalue(L, index);
+        ref_ = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+
+    LuaRegistryRef(const LuaRegistryRef&) = delete;
+    LuaRegistryRef& operator=(const LuaRegistryRef&) = delete;
+
+    LuaRegistryRef(LuaRegistryRef&& other) noexcept
+        : state_(std::exchange(other.state_, nullptr)), ref_(std::exchange(other.ref_, LUA_NOREF)) {}
+
+    LuaRegistryRef& operator=(LuaRegistryRef&& other) noexcept {
+        if (this != &other) {
+            reset();
+            state_ = std::exchange(other.state_, nullptr);
+            ref_ = std::exchange(other.ref_, LUA_NOREF);
+        }
+        return *this;
+    }
+
+    ~LuaRegistryRef() {
+        reset();
+    }
+
+    void reset() {
+        if (state_ && ref_ != LUA_NOREF) {
+            luaL_unref(state_, LUA_REGISTRYINDEX, ref_);
+        }
+        state_ = nullptr;
+        ref_ = LUA_NOREF;
+    }
+
+    void push() const {
+        lua_rawgeti(state_, LUA_REGISTRYINDEX, ref_);
+    }
+
+    lua_State* state() const { return state_; }
+    explicit operator bool() const { return ref_ != LUA_NOREF; }
+
+private:
+    lua_State* state_ = nullptr;
+    int ref_ = LUA_NOREF;
+};
+
+// Array part of a Lua table, decoded one element at a time instead of
+// materialized into a vector. The length is taken when the result is read.
+//   auto scores = CallLuaFunction<LuaSequenceRange<double>>(L, "scores");
+//   auto it = std::ranges::find_if(scores, [](double s) { return s > 0.9; });
+template<typename T>
+class LuaSequenceRange {
+public:
+    class iterator {
+    public:
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+
+        iterator() = default;
+
+        T operator*() const { return range_->at(static_cast<size_t>(index_)); }
+
+        iterator& operator++() {
+            ++index_;
+            return *this;
+        }
+
+        void operator++(int) { ++index_; }
+
+        bool operator==(std::default_sentinel_t) const {
+            return static_cast<size_t>(index_) >= range_->size_;
+        }
+
+    private:
+        friend class LuaSequenceRange;
+        explicit iterator(const LuaSequenceRange* range) : range_(range) {}
+
+        const LuaSequenceRange* range_ = nullptr;
+        std::ptrdiff_t index_ = 0;
+    };
+
+    LuaSequenceRange() = default;
+
+    static LuaSequenceRange fromLuaStack(lua_State* L, const char* fn, int index) {
+        if (!lua_istable(L, index)) {
+            throw std::runtime_error(std::format("Unexpected non-table type {}, expected a sequence", fn));
+        }
+        LuaSequenceRange result;
+        result.table_ = LuaRegistryRef(L, index);
+        result.size_ = static_cast<size_t>(lua_rawlen(L, index));
+        return result;
+    }
+
+    iterator begin() const { return iterator(this); }
+    std::default_sentinel_t end() const { return {}; }
+    size_t size() const { return size_; }
+
+    // Zero-based, decodes element i + 1 of the table
+    T at(size_t i) const {
+        if (i >= size_) {
+            throw std::out_of_range(std::format("LuaSequenceRange index {} out of range (size {})", i, size_));
+        }
+        lua_State* L = table_.state();
+        int top = lua_gettop(L);
+        table_.push();
+        lua_rawgeti(L, -1, static_cast<lua_Integer>(i + 1));
+        try {
+            T value = LuaFunctionCaller::readFromLuaStack<T>(L, "read from a LuaSequenceRange", -1);
+            lua_settop(L, top);
+            return value;
+        } catch (...) {
+            lua_settop(L, top);
+            throw;
+        }
+    }
+
+private:
+    LuaRegistryRef table_;
+    size_t size_ = 0;
+};
+
+// Key/value pairs of a Lua table visited with lua_next, decoded one pair at
+// a time. Single pass: begin() starts the traversal and may be called once.
+// The table must not gain new keys while it is being traversed.
+//   for (const auto& [name, hp] : CallLuaFunction<LuaTableRange<std::string, int>>(L, "units")) { ... }
+template<typename K, typename V>
+class LuaTableRange {
+public:
+    using value_type = std::pair<K, V>;
+
+    class iterator {
+    public:
+        using value_type = std::pair<K, V>;
+        using difference_type = std::ptrdiff_t;
+
+        iterator() = default;
+
+        const value_type& operator*() const { return *range_->current_; }
+        const value_type* operator->() const { return &*range_->current_; }
+
+        iterator& operator++() {
+            range_->advance();
+            return *this;
+        }
+
+        void operator++(int) { range_->advance(); }
+
+        bool operator==(std::default_sentinel_t) const { return !range_->current_; }
+
+    private:
+        friend class LuaTableRange;
+        explicit iterator(LuaTableRange* range) : range_(range) {}
+
+        LuaTableRange* range_ = nullptr;
+    };
+
+    LuaTableRange() = default;
+
+    static LuaTableRange fromLuaStack(lua_State* L, const char* fn, int index) {
+        if (!lua_istable(L, index)) {
+            throw std::runtime_error(std::format("Unexpected non-table type {}, expected a table", fn));
+        }
+        // Holder {table, current key} keeps the traversal key alive between steps
+        index = lua_absindex(L, index);
+        lua_createtable(L, 2, 0);
+        lua_pushvalue(L, index);
+        lua_rawseti(L, -2, 1);
+        LuaTableRange result;
+        result.holder_ = LuaRegistryRef(L, -1);
+        lua_pop(L, 1);
+        return result;
+    }
+
+    iterator begin() {
+        if (!started_) {
+            started_ = true;
+            advance();
+        }
+        return iterator(this);
+    }
+
+    std::default_sentinel_t end() const { return {}; }
+
+private:
+    void advance() {
+        lua_State* L = holder_.state();
+        int top = lua_gettop(L);
+        holder_.push();
+        lua_rawgeti(L, -1, 1);
+        lua_rawgeti(L, -2, 2);
+        if (lua_next(L, -2) == 0) {
+            current_.reset();
+            lua_settop(L, top);
+            return;
+        }
+        try {
+            current_.emplace(LuaFunctionCaller::readFromLuaStack<K>(L, "read from a LuaTableRange key", -2),
+                             LuaFunctionCaller::readFromLuaStack<V>(L, "read from a LuaTableRange", -1));
+        } catch (...) {
+            current_.reset();
+            lua_settop(L, top);
+            throw;
+        }
+        lua_pop(L, 1);
+        lua_rawseti(L, -3, 2);  // Remember the key for the next lua_next
+        lua_settop(L, top);
+    }
+
+    LuaRegistryRef holder_;
+    std::optional<value_type> current_;
+    bool started_ = false;
+};
+
+// Values produced one at a time by a Lua closure iterator (called until it
+// returns nil) or a coroutine (resumed until it finishes, each yield is a
+// value). Single pass like LuaTableRange.
+//   function ids() return coroutine.create(function() for i = 1, n do coroutine.yield(i) end end) end
+//   for (int id : CallLuaFunction<LuaGenerator<int>>(L, "ids")) { ... }
+template<typename T>
+class LuaGenerator {
+public:
+    class iterator {
+    public:
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+
+        iterator() = default;
+
+        const T& operator*() const { return *generator_->current_; }
+        const T* operator->() const { return &*generator_->current_; }
+
+        iterator& operator++() {
+            generator_->advance();
+            return *this;
+        }
+
+        void operator++(int) { generator_->advance(); }
+
+        bool operator==(std::default_sentinel_t) const { return !generator_->current_; }
+
+    private:
+        friend class LuaGenerator;
+        explicit iterator(LuaGenerator* generator) : generator_(generator) {}
+
+        LuaGenerator* generator_ = nullptr;
+    };
+
+    LuaGenerator() = default;
+
+    static LuaGenerator fromLuaStack(lua_State* L, const char* fn, int index) {
+        LuaGenerator result;
+        if (lua_type(L, index) == LUA_TTHREAD) {
+            result.coroutine_ = lua_tothread(L, index);
+        } else if (!lua_isfunction(L, index)) {
+            throw std::runtime_error(std::format("Unexpected non-function type {}, expected a function or coroutine", fn));
+        }
+        result.source_ = LuaRegistryRef(L, index);
+        return result;
+    }
+
+    iterator begin() {
+        if (!started_) {
+            started_ = true;
+            advance();
+        }
+        return iterator(this);
+    }
+
+    std::default_sentinel_t end() const { return {}; }
+
+private:
+    void advance() {
+        current_.reset();
+        if (coroutine_) {
+            resume();
+        } else {
+            call();
+        }
+    }
+
+    void call() {
+        lua_State* L = source_.state();
+        int top = lua_gettop(L);
+        source_.push();
+        if (lua_pcall(L, 0, 1, 0) != LUA_OK) {
+            std::string message = lua_tostring(L, -1) ? lua_tostring(L, -1) : "unknown error";
+            lua_settop(L, top);
+            throw std::runtime_error(message);
+        }
+        try {
+            if (!lua_isnil(L, -1)) {
+                current_.emplace(LuaFunctionCaller::readFromLuaStack<T>(L, "returned by a LuaGenerator iterator", -1));
+            }
+        } catch (...) {
+            lua_settop(L, top);
+            throw;
+        }
+        lua_settop(L, top);
+    }
+
+    void resume() {
+        lua_State* co = coroutine_;
+        if (lua_status(co) != LUA_YIELD && lua_gettop(co) == 0) {
+            return;  // Finished (or errored) earlier
+        }
+        int results;
+#if LUA_VERSION_NUM >= 504
+        int status = lua_resume(co, source_.state(), 0, &results);
+#else
+        int status = lua_resume(co, source_.state(), 0);
+        results = lua_gettop(co);
+#endif
+        if (status == LUA_YIELD) {
+            try {
+                if (results > 0 && !lua_isnil(co, -results)) {
+                    current_.emplace(LuaFunctionCaller::readFromLuaStack<T>(co, "yielded by a LuaGenerator coroutine", -results));
+                }
+            } catch (...) {
+                lua_pop(co, results);
+                throw;
+            }
+            lua_pop(co, results);
+        } else if (status == LUA_OK) {
+            lua_pop(co, results);  // Return values end the sequence
+        } else {
+            std::string message = lua_tostring(co, -1) ? lua_tostring(co, -1) : "unknown error";
+            lua_settop(co, 0);
+            throw std::runtime_error(message);
+        }
+    }
+
+    LuaRegistryRef source_;
+    lua_State* coroutine_ = nullptr;
+    std::optional<T> current_;
+    bool started_ = false;
+};
+
+#endif
@@ -0,0 +1,413 @@
+#ifndef LUA_LUASNAPSHOT
+#define LUA_LUASNAPSHOT
+
+#include "lua_bindings.hpp"
+#include "lua_mapped_file.hpp"
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+
+// Binary copy of a Lua value graph that can be restored into any state:
+// nil, booleans, numbers, strings and tables of those, with tables and
+// repeated strings written once and referenced afterwards, so shared
+// subtables stay shared and cycles survive. Metatables are not captured;
+// functions, userdata and threads are rejected.
+//
+// Capture walks the stack value directly into one buffer and restore
+// rebuilds it with presized lua_createtable, without going through C++
+// containers. Snapshots are immutable and cheap to copy (the buffer is
+// shared), so one capture can be fanned out to many states or saved, and a
+// saved file is restored straight from its mapping.
+//   LuaSnapshot context = CallLuaFunction<LuaSnapshot>(L, "export_context");
+//   for (lua_State* other : states) CallLuaFunction<void>(other, "import_context", context);
+//   context.save("context.lsnp");  ...  LuaSnapshot::map("context.lsnp").push(L);
+//
+// Layout: a 16-byte header (magic, version, lua_Integer and lua_Number sizes,
+// byte order, table and string counts) followed by one tagged value.
+// Snapshots are only read back by builds with the same number layout.
+class LuaSnapshot {
+public:
+    LuaSnapshot() = default;
+
+    // Capture the value at index
+    static LuaSnapshot capture(lua_State* L, int index) {
+        return fromLuaStack(L, "captured in a LuaSnapshot", index);
+    }
+
+    static LuaSnapshot fromLuaStack(lua_State* L, const char* fn, int index) {
+        auto bytes = std::make_shared<std::string>();
+        Encoder encoder{L, fn, *bytes};
+        int top = lua_gettop(L);
+        try {
+            encoder.encode(lua_absindex(L, index));
+        } catch (...) {
+            lua_settop(L, top);
+            throw;
+        }
+        LuaSnapshot snapshot;
+        snapshot.bytes_ = *bytes;
+        snapshot.owner_ = std::move(bytes);
+        return snapshot;
+    }
+
+    // Take ownership of bytes produced by bytes() or save()
+    static LuaSnapshot fromBytes(std::string bytes) {
+        auto owned = std::make_shared<std::string>(std::move(bytes));
+        LuaSnapshot snapshot;
+        snapshot.bytes_ = *owned;
+        snapshot.owner_ = std::move(owned);
+        return snapshot;
+    }
+
+    // Memory-map a saved snapshot; restores read strings from the mapping
+    static LuaSnapshot map(const std::filesystem::path& path) {
+        auto file = std::make_shared<LuaMappedFile>(path);
+        if (!*file) {
+            throw std::runtime_error(std::format("Cannot read Lua snapshot '{}'", path.string()));
+        }
+        LuaSnapshot snapshot;
+        snapshot.bytes_ = file->view();
+        snapshot.owner_ = std::move(file);
+        return snapshot;
+    }
+
+    // Push the value onto L; an empty snapshot pushes nil
+    void push(lua_State* L) const {
+        push(L, bytes_);
+    }
+
+    void toLuaStack(lua_State* L) const {
+        push(L);
+    }
+
+    // Restore a snapshot from any buffer, e.g. one received over the network.
+    // Malformed input throws with the stack unchanged.
+    static void push(lua_State* L, std::string_view bytes) {
+        if (bytes.empty()) {
+            lua_pushnil(L);
+            return;
+        }
+        int top = lua_gettop(L);
+        try {
+            Decoder decoder{L, reinterpret_cast<const unsigned char*>(bytes.data()),
+                            reinterpret_cast<const unsigned char*>(bytes.data() + bytes.size())};
+            decoder.decode();
+        } catch (...) {
+            lua_settop(L, top);
+            throw;
+        }
+    }
+
+    std::string_view bytes() const { return bytes_; }
+    size_t size() const { return bytes_.size(); }
+
+    // Write atomically, for LuaSnapshot::map after a restart
+    bool save(const std::filesystem::path& path) const {
+        return WriteLuaFileAtomically(path, bytes_);
+    }
+
+private:
+    static constexpr char kMagic[4] = {'L', 'S', 'N', 'P'};
+    static constexpr uint8_t kVersion = 1;
+    static constexpr size_t kHeaderSize = 16;
+    static constexpr int kMaxDepth = 200;
+    static constexpr size_t kMinSharedString = 3;  // Shorter strings are cheaper inline
+
+    enum Tag : uint8_t { Nil, False, True, Integer, Number, String, StringRef, Table, TableRef };
+
+    static uint8_t byteOrder() {
+        uint16_t probe = 1;
+        unsigned char first;
+        std::memcpy(&first, &probe, 1);
+        return first;
+    }
+
+    struct Encoder {
+        lua_State* L;
+        const char* fn;
+        std::string& out;
+        std::unordered_map<const void*, uint32_t> tables{};
+        std::unordered_map<const void*, uint32_t> strings{};
+
+        void encode(int index) {
+            out.reserve(256);
+            out.append(kMagic, sizeof(kMagic));
+            out.push_back(static_cast<char>(kVersion));
+            out.push_back(static_cast<char>(sizeof(lua_Integer)));
+            out.push_back(static_cast<char>(sizeof(lua_Number)));
+            out.push_back(static_cast<char>(byteOrder()));
+            out.append(8, '\0');  // Table and string counts, patched below
+            value(index, 0);
+            patch(8, static_cast<uint32_t>(tables.size()));
+            patch(12, static_cast<uint32_t>(strings.size()));
+        }
+
+        void value(int index, int depth) {
+            switch (lua_type(L, index)) {
+                case LUA_TNIL:
+                    out.push_back(Nil);
+                    break;
+                case LUA_TBOOLEAN:
+                    out.push_back(lua_toboolean(L, index) ? True : False);
+                    break;
+                case LUA_TNUMBER:
+                    if (lua_isinteger(L, index)) {
+                        // Zigzag varint, small magnitudes take one or two bytes
+                        lua_Unsigned n = static_cast<lua_Unsigned>(lua_tointeger(L, index));
+                        out.push_back(Integer);
+                        varint((n << 1) ^ (lua_tointeger(L, index) < 0 ? ~lua_Unsigned(0) : 0));
+                    } else {
+                        lua_Number n = lua_tonumber(L, index);
+                        out.push_back(Number);
+                        out.append(reinterpret_cast<const char*>(&n), sizeof(n));
+                    }
+                    break;
+                case LUA_TSTRING:
+                    string(index);
+                    break;
+                case LUA_TTABLE:
+                    table(index, depth);
+                    break;
+                default:
+                    throw std::runtime_error(std::format("Cannot snapshot a {} {}", luaL_typename(L, index), fn));
+            }
+        }
+
+        // Identical short strings are one interned object, so the pointer
+        // is a cheap identity for deduplication
+        void string(int index) {
+            size_t len;
+            const char* str = lua_tolstring(L, index, &len);
+            if (len >= kMinSharedString) {
+                auto [it, inserted] = strings.try_emplace(str, static_cast<uint32_t>(strings.size()));
+                if (!inserted) {
+                    out.push_back(StringRef);
+                    varint(it->second);
+                    return;
+                }
+            }
+            out.push_back(String);
+            varint(len);
+            out.append(str, len);
+        }
+
+        void table(int index, int depth) {
+            auto [it, inserted] = tables.try_emplace(lua_topointer(L, index), static_cast<uint32_t>(tables.size()));
+            if (!inserted) {
+                out.push_back(TableRef);
+                varint(it->second);
+                return;
+            }
+            if (depth >= kMaxDepth) {
+                throw std::runtime_error(std::format("Table nested deeper than {} levels {}", kMaxDepth, fn));
+            }
+            if (!lua_checkstack(L, 3)) {
+                throw std::runtime_error(std::format("Lua stack overflow while capturing a table {}", fn));
+            }
+
+            lua_Integer arraySize = static_cast<lua_Integer>(lua_rawlen(L, index));
+            out.push_back(Table);
+            varint(static_cast<lua_Unsigned>(arraySize));
+            size_t countOffset = out.size();
+            out.append(4, '\0');
+            for (lua_Integer i = 1; i <= arraySize; ++i) {
+                lua_rawgeti(L, index, i);
+                value(lua_gettop(L), depth + 1);
+                lua_pop(L, 1);
+            }
+
+            uint32_t count = 0;
+            lua_pushnil(L);
+            while (lua_next(L, index) != 0) {
+                if (lua_isinteger(L, -2) && lua_tointeger(L, -2) >= 1 && lua_tointeger(L, -2) <= arraySize) {
+                    lua_pop(L, 1);
+                    continue;
+                }
+                int top = lua_gettop(L);
+                value(top - 1, depth + 1);
+                value(top, depth + 1);
+                lua_pop(L, 1);
+                ++count;
+            }
+            patch(countOffset, count);
+        }
+
+        void varint(lua_Unsigned n) {
+            while (n >= 0x80) {
+                out.push_back(static_cast<char>((n & 0x7f) | 0x80));
+                n >>= 7;
+            }
+            out.push_back(static_cast<char>(n));
+        }
+
+        void patch(size_t offset, uint32_t n) {
+            std::memcpy(out.data() + offset, &n, sizeof(n));
+        }
+    };
+
+    struct Decoder {
+        lua_State* L;
+        const unsigned char* p;
+        const unsigned char* end;
+        std::vector<std::string_view> strings{};
+        uint32_t tableCount = 0;
+        uint32_t tablesSeen = 0;
+        int refs = 0;
+
+        void decode() {
+            if (static_cast<size_t>(end - p) < kHeaderSize || std::memcmp(p, kMagic, sizeof(kMagic)) != 0) {
+                corrupt("missing header");
+            }
+            if (p[4] != kVersion || p[5] != sizeof(lua_Integer) || p[6] != sizeof(lua_Number) || p[7] != byteOrder()) {
+                throw std::runtime_error("Lua snapshot was written by an incompatible build");
+            }
+            uint32_t stringCount;
+            std::memcpy(&tableCount, p + 8, sizeof(tableCount));
+            std::memcpy(&stringCount, p + 12, sizeof(stringCount));
+            p += kHeaderSize;
+            if (stringCount > static_cast<size_t>(end - p) || tableCount > static_cast<size_t>(end - p)) {
+                corrupt("counts exceed the buffer");
+            }
+            strings.reserve(stringCount);
+
+            if (!lua_checkstack(L, 4)) {
+                throw std::runtime_error("Lua stack overflow while restoring a snapshot");
+            }
+            // Restored tables by id, for references
+            if (tableCount > 0) {
+                lua_createtable(L, static_cast<int>(tableCount), 0);
+                refs = lua_gettop(L);
+            }
+            value(0);
+            if (p != end) {
+                corrupt("trailing bytes");
+            }
+            if (refs) {
+                lua_remove(L, refs);
+            }
+        }
+
+        void value(int depth) {
+            switch (byte()) {
+                case Nil:
+                    lua_pushnil(L);
+                    break;
+                case False:
+                    lua_pushboolean(L, 0);
+                    break;
+                case True:
+                    lua_pushboolean(L, 1);
+                    break;
+                case Integer: {
+                    lua_Unsigned n = varint();
+                    lua_pushinteger(L, static_cast<lua_Integer>((n >> 1) ^ (~(n & 1) + 1)));
+                    break;
+                }
+                case Number: {
+                    lua_Number n;
+                    std::memcpy(&n, take(sizeof(n)), sizeof(n));
+                    lua_pushnumber(L, n);
+                    break;
+                }
+                case String: {
+                    size_t len = static_cast<size_t>(varint());
+                    const char* str = reinterpret_cast<const char*>(take(len));
+                    if (len >= kMinSharedString) {
+                        strings.emplace_back(str, len);
+                    }
+                    lua_pushlstring(L, str, len);
+                    break;
+                }
+                case StringRef: {
+                    lua_Unsigned id = varint();
+                    if (id >= strings.size()) {
+                        corrupt("unknown string reference");
+                    }
+                    lua_pushlstring(L, strings[id].data(), strings[id].size());
+                    break;
+                }
+                case Table:
+                    table(depth);
+                    break;
+                case TableRef: {
+                    lua_Unsigned id = varint();
+                    if (id >= tablesSeen) {
+                        corrupt("unknown table reference");
+                    }
+                    lua_rawgeti(L, refs, static_cast<lua_Integer>(id + 1));
+                    break;
+                }
+                default:
+                    corrupt("unknown tag");
+            }
+        }
+
+        void table(int depth) {
+            if (depth >= kMaxDepth || tablesSeen >= tableCount) {
+                corrupt("bad table nesting");
+            }
+            if (!lua_checkstack(L, 4)) {
+                throw std::runtime_error("Lua stack overflow while restoring a snapshot");
+            }
+            lua_Unsigned arraySize = varint();
+            uint32_t count;
+            std::memcpy(&count, take(sizeof(count)), sizeof(count));
+            // Every value takes at least one byte, which bounds the presizing
+            size_t remaining = static_cast<size_t>(end - p);
+            if (arraySize > remaining || count > remaining / 2) {
+                corrupt("table larger than the buffer");
+            }
+
+            lua_createtable(L, static_cast<int>(arraySize), static_cast<int>(count));
+            lua_pushvalue(L, -1);
+            lua_rawseti(L, refs, ++tablesSeen);  // Before the children, for cycles
+            for (lua_Unsigned i = 1; i <= arraySize; ++i) {
+                value(depth + 1);
+                lua_rawseti(L, -2, static_cast<lua_Integer>(i));
+            }
+            for (uint32_t i = 0; i < count; ++i) {
+                value(depth + 1);
+                if (lua_isnil(L, -1) || (lua_type(L, -1) == LUA_TNUMBER && std::isnan(lua_tonumber(L, -1)))) {
+                    corrupt("invalid table key");
+                }
+                value(depth + 1);
+                lua_rawset(L, -3);
+            }
+        }
+
+        unsigned char byte() {
+            return *take(1);
+        }
+
+        const unsigned char* take(size_t n) {
+            if (static_cast<size_t>(end - p) < n) {
+                corrupt("truncated");
+            }
+            const unsigned char* result = p;
+            p += n;
+            return result;
+        }
+
+        lua_Unsigned varint() {
+            lua_Unsigned n = 0;
+            for (unsigned shift = 0; shift < sizeof(lua_Unsigned) * 8; shift += 7) {
+                unsigned char b = byte();
+                n |= static_cast<lua_Unsigned>(b & 0x7f) << shift;
+                if (!(b & 0x80)) {
+                    return n;
+                }
+            }
+            corrupt("overlong varint");
+            return 0;
+        }
+
+        [[noreturn]] static void corrupt(const char* what) {
+            throw std::runtime_error(std::format("Corrupt Lua snapshot: {}", what));
+        }
+    };
+
+    std::shared_ptr<const void> owner_;
+    std::string_view bytes_;
+};
+
+#endif
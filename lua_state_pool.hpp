@@ -0,0 +1,241 @@
+#ifndef LUA_LUASTATEPOOL
+#define LUA_LUASTATEPOOL
+
+#include "lua_bindings.hpp"
+#include "lua_hot_reload.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Pool of identical lua_States, one pinned to each worker thread.
+// Every state runs the same initialization chunk (source or bytecode), so a
+// call can run on any worker. Tasks are queued per worker and idle workers
+// steal from the others, so a hot function never serializes on one state.
+// Versions published through reloader() are applied by each worker between
+// two tasks.
+//   LuaStatePool pool(8, script);
+//   std::future<int> sum = pool.submit<int>("add", 1, 2);
+//   pool.reloader().reload(newScript);
+class LuaStatePool {
+public:
+    LuaStatePool(size_t size, std::string_view initChunk, std::function<void(lua_State*)> setup = {}) {
+        if (size == 0) {
+            throw std::invalid_argument("LuaStatePool needs at least one state");
+        }
+
+        workers_.reserve(size);
+        try {
+            for (size_t i = 0; i < size; ++i) {
+                auto worker = std::make_unique<Worker>();
+                worker->L = createState(initChunk, setup);
+                workers_.push_back(std::move(worker));
+            }
+        } catch (...) {
+            for (auto& worker : workers_) {
+                lua_close(worker->L);
+            }
+            throw;
+        }
+
+        // A failed thread start stops the workers already running; they
+        // have no tasks yet, so they return as soon as they wake
+        try {
+            for (size_t i = 0; i < size; ++i) {
+                workers_[i]->thread = std::thread([this, i] { run(i); });
+            }
+        } catch (...) {
+            stop();
+            throw;
+        }
+    }
+
+    LuaStatePool(const LuaStatePool&) = delete;
+    LuaStatePool& operator=(const LuaStatePool&) = delete;
+
+    // Finishes every queued task before closing the states
+    ~LuaStatePool() {
+        stop();
+    }
+
+    size_t size() const { return workers_.size(); }
+
+    LuaHotReloader& reloader() { return reloader_; }
+
+    // Queue a CallLuaFunction on any worker. Arguments are copied into the
+    // task; const char* and std::string_view are stored as std::string.
+    // Types that only point at the caller's memory (LuaBuffer, LuaView,
+    // LuaValue, std::span, std::reference_wrapper, pointers) are rejected,
+    // since the task may run after that memory is gone.
+    template<typename... ReturnTypes, typename... Args>
+    auto submit(std::string_view functionName, Args&&... args) {
+        static_assert(!(LuaFunctionCaller::lendsMemory<StoredArg<Args>>() || ...),
+                      "LuaStatePool::submit arguments must own their data, pass a copy or use execute()");
+        return execute([functionName = std::string(functionName), stored = std::make_tuple(StoredArg<Args>(std::forward<Args>(args))...)](lua_State* L) {
+            return std::apply([&](const auto&... values) {
+                return CallLuaFunction<ReturnTypes...>(L, functionName, values...);
+            }, stored);
+        });
+    }
+
+    // Queue arbitrary work against a worker's state
+    template<typename Callable>
+    auto execute(Callable&& callable) {
+        using Result = std::invoke_result_t<std::decay_t<Callable>&, lua_State*>;
+        auto task = std::make_unique<Task<Result, std::decay_t<Callable>>>(std::forward<Callable>(callable));
+        std::future<Result> future = task->promise.get_future();
+        enqueue(std::move(task));
+        return future;
+    }
+
+private:
+    struct TaskBase {
+        virtual ~TaskBase() = default;
+        virtual void run(lua_State* L) = 0;
+    };
+
+    template<typename Result, typename Callable>
+    struct Task : TaskBase {
+        explicit Task(Callable&& c) : callable(std::move(c)) {}
+        explicit Task(const Callable& c) : callable(c) {}
+
+        void run(lua_State* L) override {
+            try {
+                if constexpr (std::is_void_v<Result>) {
+                    callable(L);
+                    promise.set_value();
+                } else {
+                    promise.set_value(callable(L));
+                }
+            } catch (...) {
+                promise.set_exception(std::current_exception());
+            }
+        }
+
+        Callable callable;
+        std::promise<Result> promise;
+    };
+
+    struct Worker {
+        lua_State* L = nullptr;
+        std::thread thread;
+        std::mutex mutex;
+        std::deque<std::unique_ptr<TaskBase>> tasks;
+    };
+
+    // Borrowed strings would dangle once submit() returns
+    template<typename Arg>
+    using StoredArg = std::conditional_t<
+        std::is_same_v<std::decay_t<Arg>, const char*> || std::is_same_v<std::decay_t<Arg>, char*> || std::is_same_v<std::decay_t<Arg>, std::string_view>,
+        std::string, std::decay_t<Arg>>;
+
+    static lua_State* createState(std::string_view initChunk, const std::function<void(lua_State*)>& setup) {
+        lua_State* L = luaL_newstate();
+        if (!L) {
+            throw std::runtime_error("Failed to create lua_State");
+        }
+        luaL_openlibs(L);
+        if (setup) {
+            try {
+                setup(L);
+            } catch (...) {
+                lua_close(L);
+                throw;
+            }
+        }
+        if (luaL_loadbufferx(L, initChunk.data(), initChunk.size(), "=init", "bt") != LUA_OK || lua_pcall(L, 0, 0, 0) != LUA_OK) {
+            std::string message = lua_tostring(L, -1) ? lua_tostring(L, -1) : "unknown error";
+            lua_close(L);
+            throw std::runtime_error(message);
+        }
+        return L;
+    }
+
+    // Counts the task before publishing it, so a worker that takes it at
+    // once cannot decrement pending_ below zero
+    void enqueue(std::unique_ptr<TaskBase> task) {
+        Worker& worker = *workers_[next_.fetch_add(1, std::memory_order_relaxed) % workers_.size()];
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex_);
+            ++pending_;
+        }
+        try {
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            worker.tasks.push_back(std::move(task));
+        } catch (...) {
+            pending_.fetch_sub(1, std::memory_order_relaxed);
+            throw;
+        }
+        wake_.notify_one();
+    }
+
+    // Own queue from the front, other queues from the back
+    std::unique_ptr<TaskBase> take(size_t self) {
+        for (size_t offset = 0; offset < workers_.size(); ++offset) {
+            Worker& worker = *workers_[(self + offset) % workers_.size()];
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            if (worker.tasks.empty()) {
+                continue;
+            }
+            std::unique_ptr<TaskBase> task;
+            if (offset == 0) {
+                task = std::move(worker.tasks.front());
+                worker.tasks.pop_front();
+            } else {
+                task = std::move(worker.tasks.back());
+                worker.tasks.pop_back();
+            }
+            pending_.fetch_sub(1, std::memory_order_relaxed);
+            return task;
+        }
+        return nullptr;
+    }
+
+    // Joins the workers that were started, then closes every state
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        for (auto& worker : workers_) {
+            if (worker->thread.joinable()) {
+                worker->thread.join();
+            }
+            lua_close(worker->L);
+        }
+    }
+
+    void run(size_t self) {
+        lua_State* L = workers_[self]->L;
+        uint64_t version = 0;
+        while (true) {
+            if (auto task = take(self)) {
+                if (reloader_.version() != version) {
+                    version = reloader_.poll(L);
+                }
+                task->run(L);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleepMutex_);
+            wake_.wait(lock, [this] { return stopping_ || pending_.load(std::memory_order_relaxed) > 0; });
+            if (stopping_ && pending_.load(std::memory_order_relaxed) == 0) {
+                return;
+            }
+        }
+    }
+
+    LuaHotReloader reloader_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::atomic<size_t> next_{0};
+    std::atomic<size_t> pending_{0};
+    std::mutex sleepMutex_;
+    std::condition_variable wake_;
+    bool stopping_ = false;
+};
+
+#endif
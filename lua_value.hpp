@@ -0,0 +1,524 @@
+#ifndef LUA_LUAVALUE
+#define LUA_LUAVALUE
+
+#include "lua_bindings.hpp"
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <memory_resource>
+#include <new>
+
+class LuaTable;
+
+// Compact dynamically typed Lua value: 16 bytes, trivially copyable, no
+// allocation of its own. Strings of up to 14 bytes are stored inline;
+// longer strings and tables point into the LuaDocument they were read into
+// (or, for strings built from C++, into the caller's storage), so a LuaValue
+// is a view like std::string_view and must not outlive that storage.
+// Equality and hashing follow Lua raw equality: 1 == 1.0, tables compare by
+// identity, and nil is an ordinary value that can be a C++ map key.
+class LuaValue {
+public:
+    enum class Type : uint8_t { Nil, Boolean, Integer, Number, String, Table };
+
+    static constexpr size_t kInlineCapacity = 14;
+
+    LuaValue() = default;
+    LuaValue(std::nullopt_t) {}
+
+    LuaValue(bool value) : tag_(Tag::Boolean) {
+        bytes_[0] = value ? 1 : 0;
+    }
+
+    template<typename T>
+        requires (std::is_integral_v<T> && !std::is_same_v<T, bool>)
+    LuaValue(T value) : tag_(Tag::Integer) {
+        store(static_cast<lua_Integer>(value));
+    }
+
+    template<typename T>
+        requires std::is_floating_point_v<T>
+    LuaValue(T value) : tag_(Tag::Number) {
+        store(static_cast<lua_Number>(value));
+    }
+
+    // Short strings are copied inline, longer ones are borrowed
+    LuaValue(std::string_view value) {
+        if (value.size() <= kInlineCapacity) {
+            tag_ = Tag::ShortString;
+            std::memcpy(bytes_, value.data(), value.size());
+            bytes_[kInlineCapacity] = static_cast<unsigned char>(value.size());
+        } else {
+            if (value.size() > UINT32_MAX) {
+                throw std::length_error("String too long for a LuaValue");
+            }
+            tag_ = Tag::LongString;
+            store(value.data());
+            uint32_t size = static_cast<uint32_t>(value.size());
+            std::memcpy(bytes_ + sizeof(const char*), &size, sizeof(size));
+        }
+    }
+
+    // Otherwise string literals would convert to bool
+    LuaValue(const char* value) : LuaValue(std::string_view(value)) {}
+
+    Type type() const {
+        switch (tag_) {
+            case Tag::Nil: return Type::Nil;
+            case Tag::Boolean: return Type::Boolean;
+            case Tag::Integer: return Type::Integer;
+            case Tag::Number: return Type::Number;
+            case Tag::ShortString:
+            case Tag::LongString: return Type::String;
+            case Tag::Table: return Type::Table;
+        }
+        return Type::Nil;
+    }
+
+    bool isNil() const { return tag_ == Tag::Nil; }
+    bool isBoolean() const { return tag_ == Tag::Boolean; }
+    bool isInteger() const { return tag_ == Tag::Integer; }
+    bool isNumber() const { return tag_ == Tag::Integer || tag_ == Tag::Number; }
+    bool isString() const { return tag_ == Tag::ShortString || tag_ == Tag::LongString; }
+    bool isTable() const { return tag_ == Tag::Table; }
+
+    bool asBoolean() const {
+        expect(isBoolean(), "a boolean");
+        return bytes_[0] != 0;
+    }
+
+    // Floats with an integral value convert like math.tointeger
+    lua_Integer asInteger() const {
+        if (tag_ == Tag::Number) {
+            lua_Integer result;
+            expect(floatToInteger(load<lua_Number>(), result), "an integer");
+            return result;
+        }
+        expect(isInteger(), "an integer");
+        return load<lua_Integer>();
+    }
+
+    lua_Number asNumber() const {
+        if (tag_ == Tag::Integer) {
+            return static_cast<lua_Number>(load<lua_Integer>());
+        }
+        expect(tag_ == Tag::Number, "a number");
+        return load<lua_Number>();
+    }
+
+    std::string_view asString() const {
+        if (tag_ == Tag::ShortString) {
+            return std::string_view(reinterpret_cast<const char*>(bytes_), bytes_[kInlineCapacity]);
+        }
+        expect(tag_ == Tag::LongString, "a string");
+        uint32_t size;
+        std::memcpy(&size, bytes_ + sizeof(const char*), sizeof(size));
+        return std::string_view(load<const char*>(), size);
+    }
+
+    const LuaTable& asTable() const {
+        expect(isTable(), "a table");
+        return *load<const LuaTable*>();
+    }
+
+    // Field of a table value, nil for missing keys and non-tables
+    const LuaValue& operator[](LuaValue key) const;
+
+    const char* typeName() const {
+        static constexpr const char* names[] = {"nil", "boolean", "integer", "number", "string", "table"};
+        return names[static_cast<int>(type())];
+    }
+
+    friend bool operator==(const LuaValue& a, const LuaValue& b) {
+        if (a.isNumber() && b.isNumber()) {
+            if (a.tag_ == b.tag_) {
+                return a.tag_ == Tag::Integer ? a.load<lua_Integer>() == b.load<lua_Integer>() : a.load<lua_Number>() == b.load<lua_Number>();
+            }
+            // Mixed integer and float, equal only if the float is exactly that integer
+            const LuaValue& f = a.tag_ == Tag::Number ? a : b;
+            const LuaValue& i = a.tag_ == Tag::Number ? b : a;
+            lua_Integer converted;
+            return floatToInteger(f.load<lua_Number>(), converted) && converted == i.load<lua_Integer>();
+        }
+        if (a.isString() && b.isString()) {
+            return a.asString() == b.asString();
+        }
+        if (a.tag_ != b.tag_) {
+            return false;
+        }
+        switch (a.tag_) {
+            case Tag::Nil: return true;
+            case Tag::Boolean: return a.bytes_[0] == b.bytes_[0];
+            case Tag::Table: return a.load<const LuaTable*>() == b.load<const LuaTable*>();
+            default: return false;
+        }
+    }
+
+    // Consistent with ==: integral floats hash like the integer
+    size_t hash() const {
+        switch (tag_) {
+            case Tag::Nil:
+                return 0x9e3779b97f4a7c15ull;
+            case Tag::Boolean:
+                return mix(bytes_[0] + 1);
+            case Tag::Integer:
+                return mix(static_cast<uint64_t>(load<lua_Integer>()));
+            case Tag::Number: {
+                lua_Integer integer;
+                lua_Number number = load<lua_Number>();
+                if (floatToInteger(number, integer)) {
+                    return mix(static_cast<uint64_t>(integer));
+                }
+                return mix(std::bit_cast<uint64_t>(static_cast<double>(number)) ^ 0x5bd1e995ull);
+            }
+            case Tag::ShortString:
+            case Tag::LongString:
+                return std::hash<std::string_view>{}(asString());
+            case Tag::Table:
+                return mix(reinterpret_cast<uintptr_t>(load<const LuaTable*>()));
+        }
+        return 0;
+    }
+
+    void toLuaStack(lua_State* L) const;
+
+private:
+    friend class LuaDocument;
+    friend class LuaTable;
+
+    enum class Tag : uint8_t { Nil, Boolean, Integer, Number, ShortString, LongString, Table };
+
+    explicit LuaValue(const LuaTable* table) : tag_(Tag::Table) {
+        store(table);
+    }
+
+    template<typename T>
+    void store(T value) {
+        std::memcpy(bytes_, &value, sizeof(T));
+    }
+
+    template<typename T>
+    T load() const {
+        T value;
+        std::memcpy(&value, bytes_, sizeof(T));
+        return value;
+    }
+
+    void expect(bool matches, const char* expected) const {
+        if (!matches) {
+            throw std::runtime_error(std::format("LuaValue is {}, expected {}", typeName(), expected));
+        }
+    }
+
+    static bool floatToInteger(lua_Number value, lua_Integer& out) {
+        // Both bounds are powers of two, so exactly representable
+        if (std::floor(value) != value || value < static_cast<lua_Number>(LUA_MININTEGER) || value >= -static_cast<lua_Number>(LUA_MININTEGER)) {
+            return false;
+        }
+        out = static_cast<lua_Integer>(value);
+        return true;
+    }
+
+    static size_t mix(uint64_t x) {
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdull;
+        x ^= x >> 33;
+        return static_cast<size_t>(x);
+    }
+
+    // Payload first so the tag sits in the last byte; inline strings use
+    // bytes 0-13 with their length in byte 14
+    alignas(8) unsigned char bytes_[kInlineCapacity + 1] = {};
+    Tag tag_ = Tag::Nil;
+};
+
+static_assert(sizeof(void*) != 8 || sizeof(LuaValue) == 16, "LuaValue should stay 16 bytes");
+static_assert(std::is_trivially_copyable_v<LuaValue>);
+
+struct LuaValueHasher {
+    size_t operator()(const LuaValue& value) const {
+        return value.hash();
+    }
+};
+
+template<>
+struct std::hash<LuaValue> : LuaValueHasher {};
+
+// Long strings and tables point into their LuaDocument
+template<>
+struct LuaLendsMemory<LuaValue> : std::true_type {};
+
+// Read-only table node of a LuaDocument: the array part t[1..#t] stored
+// contiguously, the remaining pairs stored densely in traversal order and
+// indexed by an open-addressed table of 32-bit slots.
+class LuaTable {
+public:
+    struct Entry {
+        LuaValue key;
+        LuaValue value;
+    };
+
+    // Value at key, nil if absent. Returned by reference so that views of
+    // inline strings stay valid as long as the document.
+    const LuaValue& get(LuaValue key) const {
+        if (key.isNumber()) {
+            lua_Integer i;
+            if (key.isInteger()) {
+                i = key.asInteger();
+            } else if (!LuaValue::floatToInteger(key.asNumber(), i)) {
+                i = 0;
+            }
+            if (i >= 1 && static_cast<uint64_t>(i) <= arraySize_) {
+                return array_[i - 1];
+            }
+        }
+        if (entryCount_ == 0) {
+            return nil();
+        }
+        for (size_t slot = key.hash() & slotMask_;; slot = (slot + 1) & slotMask_) {
+            uint32_t entry = slots_[slot];
+            if (entry == 0) {
+                return nil();
+            }
+            if (entries_[entry - 1].key == key) {
+                return entries_[entry - 1].value;
+            }
+        }
+    }
+
+    const LuaValue& operator[](LuaValue key) const {
+        return get(key);
+    }
+
+    // Border of the array part, like the # operator
+    size_t size() const { return arraySize_; }
+
+    std::span<const LuaValue> array() const { return {array_, arraySize_}; }
+    std::span<const Entry> entries() const { return {entries_, entryCount_}; }
+
+private:
+    friend class LuaDocument;
+    friend class LuaValue;
+
+    static const LuaValue& nil() {
+        static const LuaValue value;
+        return value;
+    }
+
+    const LuaValue* array_ = nullptr;
+    const Entry* entries_ = nullptr;
+    const uint32_t* slots_ = nullptr;
+    size_t arraySize_ = 0;
+    uint32_t entryCount_ = 0;
+    uint32_t slotMask_ = 0;
+};
+
+inline const LuaValue& LuaValue::operator[](LuaValue key) const {
+    return isTable() ? asTable().get(key) : LuaTable::nil();
+}
+
+inline void LuaValue::toLuaStack(lua_State* L) const {
+    switch (tag_) {
+        case Tag::Nil:
+            lua_pushnil(L);
+            break;
+        case Tag::Boolean:
+            lua_pushboolean(L, bytes_[0]);
+            break;
+        case Tag::Integer:
+            lua_pushinteger(L, load<lua_Integer>());
+            break;
+        case Tag::Number:
+            lua_pushnumber(L, load<lua_Number>());
+            break;
+        case Tag::ShortString:
+        case Tag::LongString: {
+            std::string_view str = asString();
+            lua_pushlstring(L, str.data(), str.size());
+            break;
+        }
+        case Tag::Table: {
+            const LuaTable& table = asTable();
+            if (!lua_checkstack(L, 3)) {
+                throw std::runtime_error("Lua stack overflow while pushing a LuaValue");
+            }
+            lua_createtable(L, static_cast<int>(table.size()), static_cast<int>(table.entries().size()));
+            lua_Integer i = 0;
+            for (const LuaValue& value : table.array()) {
+                ++i;
+                if (!value.isNil()) {
+                    value.toLuaStack(L);
+                    lua_rawseti(L, -2, i);
+                }
+            }
+            for (const LuaTable::Entry& entry : table.entries()) {
+                entry.key.toLuaStack(L);
+                entry.value.toLuaStack(L);
+                lua_rawset(L, -3);
+            }
+            break;
+        }
+    }
+}
+
+// Owner of a LuaValue read from Lua, with every long string and nested table
+// in one monotonic arena that is freed at once. Scalars and short strings
+// need no arena at all. Usable as a result or argument type:
+//   LuaDocument config = CallLuaFunction<LuaDocument>(L, "load_config");
+//   lua_Integer port = config.root()["server"]["port"].asInteger();
+// A table reached through several fields is decoded once and shared, like
+// in Lua; cyclic tables and tables nested deeper than kMaxDepth are rejected.
+class LuaDocument {
+public:
+    static constexpr int kMaxDepth = 64;
+
+    LuaDocument() = default;
+
+    static LuaDocument fromLuaStack(lua_State* L, const char* fn, int index) {
+        LuaDocument document;
+        int top = lua_gettop(L);
+        Tables tables;
+        try {
+            document.root_ = document.decode(L, fn, lua_absindex(L, index), 0, tables);
+        } catch (...) {
+            lua_settop(L, top);
+            throw;
+        }
+        return document;
+    }
+
+    const LuaValue& root() const { return root_; }
+
+    const LuaValue& operator[](LuaValue key) const {
+        return root_[key];
+    }
+
+    void toLuaStack(lua_State* L) const {
+        root_.toLuaStack(L);
+    }
+
+private:
+    // Tables decoded so far by address; nullptr while one is being decoded
+    using Tables = std::unordered_map<const void*, const LuaTable*>;
+
+    template<typename T>
+    T* allocate(size_t count) {
+        if (!arena_) {
+            arena_ = std::make_unique<std::pmr::monotonic_buffer_resource>();
+        }
+        return static_cast<T*>(arena_->allocate(count * sizeof(T), alignof(T)));
+    }
+
+    LuaValue decode(lua_State* L, const char* fn, int index, int depth, Tables& tables) {
+        switch (lua_type(L, index)) {
+            case LUA_TNIL:
+                return {};
+            case LUA_TBOOLEAN:
+                return LuaValue(static_cast<bool>(lua_toboolean(L, index)));
+            case LUA_TNUMBER:
+                if (lua_isinteger(L, index)) {
+                    return LuaValue(lua_tointeger(L, index));
+                }
+                return LuaValue(lua_tonumber(L, index));
+            case LUA_TSTRING: {
+                size_t len;
+                const char* str = lua_tolstring(L, index, &len);
+                if (len <= LuaValue::kInlineCapacity) {
+                    return LuaValue(std::string_view(str, len));
+                }
+                char* copy = allocate<char>(len);
+                std::memcpy(copy, str, len);
+                return LuaValue(std::string_view(copy, len));
+            }
+            case LUA_TTABLE:
+                return LuaValue(decodeTable(L, fn, index, depth, tables));
+            default:
+                throw std::runtime_error(std::format("Unexpected {} {}, expected nil, a boolean, number, string or table", luaL_typename(L, index), fn));
+        }
+    }
+
+    static bool isArrayKey(lua_State* L, int index, lua_Integer arraySize) {
+        if (!lua_isinteger(L, index)) {
+            return false;
+        }
+        lua_Integer i = lua_tointeger(L, index);
+        return i >= 1 && i <= arraySize;
+    }
+
+    const LuaTable* decodeTable(lua_State* L, const char* fn, int index, int depth, Tables& tables) {
+        auto [it, inserted] = tables.try_emplace(lua_topointer(L, index), nullptr);
+        if (!inserted) {
+            if (!it->second) {
+                throw std::runtime_error(std::format("Cyclic table {}", fn));
+            }
+            return it->second;
+        }
+        if (depth >= kMaxDepth) {
+            throw std::runtime_error(std::format("Table nested deeper than {} levels {}", kMaxDepth, fn));
+        }
+        if (!lua_checkstack(L, 4)) {
+            throw std::runtime_error(std::format("Lua stack overflow while reading a table {}", fn));
+        }
+        lua_Integer arraySize = static_cast<lua_Integer>(lua_rawlen(L, index));
+
+        // Counting pass, so every part is allocated once at its final size
+        size_t count = 0;
+        lua_pushnil(L);
+        while (lua_next(L, index) != 0) {
+            lua_pop(L, 1);
+            if (!isArrayKey(L, -1, arraySize)) {
+                ++count;
+            }
+        }
+        if (count >= UINT32_MAX / 2) {
+            throw std::runtime_error(std::format("Table too large for a LuaDocument {}", fn));
+        }
+
+        LuaTable* table = new (allocate<LuaTable>(1)) LuaTable();
+        LuaValue* array = allocate<LuaValue>(static_cast<size_t>(arraySize));
+        for (lua_Integer i = 1; i <= arraySize; ++i) {
+            lua_rawgeti(L, index, i);
+            new (&array[i - 1]) LuaValue(decode(L, fn, lua_gettop(L), depth + 1, tables));
+            lua_pop(L, 1);
+        }
+        table->array_ = array;
+        table->arraySize_ = static_cast<size_t>(arraySize);
+        if (count == 0) {
+            tables[lua_topointer(L, index)] = table;
+            return table;
+        }
+
+        size_t slotCount = std::bit_ceil(count * 2);
+        auto* entries = allocate<LuaTable::Entry>(count);
+        auto* slots = allocate<uint32_t>(slotCount);
+        std::fill_n(slots, slotCount, 0u);
+        size_t filled = 0;
+        lua_pushnil(L);
+        while (lua_next(L, index) != 0) {
+            if (isArrayKey(L, -2, arraySize) || filled == count) {
+                lua_pop(L, 1);
+                continue;
+            }
+            int top = lua_gettop(L);
+            LuaValue key = decode(L, fn, top - 1, depth + 1, tables);
+            new (&entries[filled]) LuaTable::Entry{key, decode(L, fn, top, depth + 1, tables)};
+            size_t slot = key.hash() & (slotCount - 1);
+            while (slots[slot] != 0) {
+                slot = (slot + 1) & (slotCount - 1);
+            }
+            slots[slot] = static_cast<uint32_t>(++filled);
+            lua_pop(L, 1);
+        }
+        table->entries_ = entries;
+        table->slots_ = slots;
+        table->entryCount_ = static_cast<uint32_t>(filled);
+        table->slotMask_ = static_cast<uint32_t>(slotCount - 1);
+        tables[lua_topointer(L, index)] = table;
+        return table;
+    }
+
+    std::unique_ptr<std::pmr::monotonic_buffer_resource> arena_;
+    LuaValue root_;
+};
+
+#endif
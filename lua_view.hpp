@@ -0,0 +1,318 @@
+#ifndef LUA_LUAVIEW
+#define LUA_LUAVIEW
+
+#include "lua_bindings.hpp"
+#include <new>
+
+// Lends a map-like or random access container to Lua as a proxy userdata
+// instead of copying it into a table. __index and __len read the container
+// in place, __pairs walks it (ipairs works through __index), and for
+// non-const containers __newindex writes back: sequences assign within
+// 1..#view, maps insert or assign, and nil erases the key. Elements are
+// converted when they are read, so nested containers still arrive as tables.
+// Like LuaBuffer, the userdata is detached when the LuaView is destroyed; a
+// script that keeps it past the call sees an empty view and writes fail.
+// A pairs() loop may assign and clear fields; erasing the entry the loop is
+// about to visit next is an error. Inserting is allowed but, as with next()
+// on a Lua table, the loop may then skip or repeat entries: an insert can
+// rehash an unordered container and the loop resumes from the next key's
+// new position.
+//   const std::unordered_map<std::string, double>& rates = ...;
+//   CallLuaFunction<bool>(L, "evaluate", LuaView(rates), order);
+template<typename Container>
+class LuaView {
+    using Value = std::remove_const_t<Container>;
+    static constexpr bool kMap = LuaFunctionCaller::isMapLike<Value>();
+    static_assert(kMap || (std::ranges::random_access_range<Value> && std::ranges::sized_range<Value>),
+                  "LuaView needs a map-like or random access container");
+
+public:
+    LuaView(Container& container) : container_(&container) {}
+
+    LuaView(const LuaView& other) : container_(other.container_) {}
+    LuaView& operator=(const LuaView&) = delete;
+
+    Container& container() const { return *container_; }
+
+    // Push the userdata, one LuaView lends its container to one userdata at a time
+    void toLuaStack(lua_State* L) const {
+        userdata_.push<Payload>(L, &pushMetatable)->container = container_;
+    }
+
+private:
+    struct Payload {
+        Container* container;
+        uint64_t version;  // Bumped when __newindex adds or erases an entry
+    };
+
+    // Position of a pairs() traversal: the element returned by the next
+    // step, and its key to find it again once the map changed shape
+    struct Cursor {
+        using Key = typename Value::key_type;
+        decltype(std::declval<Container&>().begin()) next;
+        std::optional<Key> nextKey;
+        uint64_t version;
+    };
+
+    // The cursor userdata; __gc empties it, so a late call finds no cursor
+    using CursorSlot = std::optional<Cursor>;
+
+    // One metatable per container type, cached in the registry under a static address
+    static inline const char kMetatableKey = 0;
+    static inline const char kCursorMetatableKey = 0;
+
+    static void pushMetatable(lua_State* L) {
+        if (lua_rawgetp(L, LUA_REGISTRYINDEX, &kMetatableKey) != LUA_TNIL) {
+            return;
+        }
+        lua_pop(L, 1);
+        lua_createtable(L, 0, 5);
+        lua_pushliteral(L, "LuaView");
+        lua_setfield(L, -2, "__metatable");  // getmetatable() cannot reach the metamethods
+        lua_pushcfunction(L, &LuaView::index);
+        lua_setfield(L, -2, "__index");
+        lua_pushcfunction(L, &LuaView::length);
+        lua_setfield(L, -2, "__len");
+        lua_pushcfunction(L, &LuaView::pairs);
+        lua_setfield(L, -2, "__pairs");
+        if constexpr (!std::is_const_v<Container>) {
+            lua_pushcfunction(L, &LuaView::newIndex);
+            lua_setfield(L, -2, "__newindex");
+        }
+        lua_pushvalue(L, -1);
+        lua_rawsetp(L, LUA_REGISTRYINDEX, &kMetatableKey);
+    }
+
+    // Raises a Lua error for any other value, so call it before guarded()
+    static Payload* target(lua_State* L, int index) {
+        return static_cast<Payload*>(CheckLuaUserdata(L, index, &kMetatableKey, "LuaView"));
+    }
+
+    // Metamethods run their C++ part in guarded(); lua_error is raised only
+    // after every C++ object of that frame is gone
+    template<typename Body>
+    static int guarded(lua_State* L, Body body) {
+        try {
+            return body();
+        } catch (const std::exception& e) {
+            lua_pushstring(L, e.what());
+        } catch (...) {
+            lua_pushstring(L, "unknown C++ exception");
+        }
+        return -1;
+    }
+
+    static int raise(lua_State* L, int results) {
+        return results < 0 ? lua_error(L) : results;
+    }
+
+    // Element at the key on the stack, end() if there is none. Integer and
+    // string keys are matched without conversions or allocations when the
+    // container allows it; a key of another Lua type never matches.
+    static auto find(lua_State* L, Container& c, int index) {
+        using Key = typename Value::key_type;
+        if constexpr (std::is_integral_v<Key> && !std::is_same_v<Key, bool>) {
+            int isnum = 0;
+            lua_Integer key = lua_type(L, index) == LUA_TNUMBER ? lua_tointegerx(L, index, &isnum) : 0;
+            return isnum ? c.find(static_cast<Key>(key)) : c.end();
+        } else if constexpr (LuaFunctionCaller::isOwnedString<Key>()) {
+            if (lua_type(L, index) != LUA_TSTRING) {
+                return c.end();
+            }
+            size_t len;
+            const char* str = lua_tolstring(L, index, &len);
+            std::string_view key(str, len);
+            if constexpr (requires { c.find(key); }) {
+                return c.find(key);  // Transparent hash or comparator
+            } else {
+                return c.find(Key(key));
+            }
+        } else if constexpr (LuaFunctionCaller::readsWithoutThrowing<Key>()) {
+            Key key{};
+            return LuaFunctionCaller::tryReadScalar(L, index, key) ? c.end() : c.find(key);
+        } else {
+            return c.find(LuaFunctionCaller::readFromLuaStack<Key>(L, "used as a LuaView key", index));
+        }
+    }
+
+    // 1-based position for sequences, 0 if the key is not an index in range
+    static size_t position(lua_State* L, const Container& c, int index) {
+        int isnum = 0;
+        lua_Integer i = lua_type(L, index) == LUA_TNUMBER ? lua_tointegerx(L, index, &isnum) : 0;
+        if (!isnum || i < 1 || static_cast<lua_Unsigned>(i) > std::ranges::size(c)) {
+            return 0;
+        }
+        return static_cast<size_t>(i);
+    }
+
+    // Through a const reference to the element type, which also converts
+    // proxy references such as std::vector<bool>'s
+    template<typename Reference>
+    static void pushElement(lua_State* L, Reference&& element) {
+        LuaFunctionCaller::pushToLuaStack(L, static_cast<const std::ranges::range_value_t<Value>&>(element));
+    }
+
+    static int index(lua_State* L) {
+        Container* c = target(L, 1)->container;
+        return raise(L, guarded(L, [L, c] {
+            if (!c) {
+                lua_pushnil(L);
+            } else if constexpr (kMap) {
+                auto it = find(L, *c, 2);
+                if (it == c->end()) {
+                    lua_pushnil(L);
+                } else {
+                    LuaFunctionCaller::pushToLuaStack(L, it->second);
+                }
+            } else if (size_t i = position(L, *c, 2)) {
+                pushElement(L, (*c)[i - 1]);
+            } else {
+                lua_pushnil(L);
+            }
+            return 1;
+        }));
+    }
+
+    // Number of elements, also the entry count for maps
+    static int length(lua_State* L) {
+        Container* c = target(L, 1)->container;
+        lua_pushinteger(L, c ? static_cast<lua_Integer>(std::ranges::size(*c)) : 0);
+        return 1;
+    }
+
+    static int newIndex(lua_State* L) {
+        Payload* payload = target(L, 1);
+        if (!payload->container) {
+            return luaL_error(L, "LuaView used after the call it was passed to returned");
+        }
+        return raise(L, guarded(L, [L, payload] {
+            Value& c = *payload->container;
+            if constexpr (kMap) {
+                using Key = typename Value::key_type;
+                using Mapped = typename Value::mapped_type;
+                if (lua_isnil(L, 3)) {
+                    auto it = find(L, c, 2);
+                    if (it != c.end()) {
+                        c.erase(it);
+                        ++payload->version;
+                    }
+                } else {
+                    Key key = LuaFunctionCaller::readFromLuaStack<Key>(L, "used as a LuaView key", 2);
+                    bool inserted = c.insert_or_assign(std::move(key), LuaFunctionCaller::readFromLuaStack<Mapped>(L, "assigned to a LuaView", 3)).second;
+                    payload->version += inserted ? 1 : 0;
+                }
+            } else {
+                size_t i = position(L, c, 2);
+                if (!i) {
+                    throw std::runtime_error("LuaView index out of range");
+                }
+                c[i - 1] = LuaFunctionCaller::readFromLuaStack<std::ranges::range_value_t<Value>>(L, "assigned to a LuaView", 3);
+            }
+            return 0;
+        }));
+    }
+
+    // Sequences iterate statelessly by index, maps with a cursor closure
+    static int pairs(lua_State* L) {
+        Payload* payload = target(L, 1);
+        if constexpr (kMap) {
+            auto* slot = new (lua_newuserdata(L, sizeof(CursorSlot))) CursorSlot(Cursor{{}, std::nullopt, payload->version});
+            Cursor* cursor = &**slot;
+            if (Container* c = payload->container) {
+                cursor->next = c->begin();
+                if (cursor->next != c->end()) {
+                    cursor->nextKey.emplace(cursor->next->first);
+                }
+            }
+            if constexpr (!std::is_trivially_destructible_v<Cursor>) {
+                pushCursorMetatable(L);
+                lua_setmetatable(L, -2);
+            }
+            lua_pushvalue(L, 1);
+            lua_pushcclosure(L, &LuaView::mapNext, 2);
+        } else {
+            lua_pushcfunction(L, &LuaView::sequenceNext);
+        }
+        lua_pushvalue(L, 1);
+        lua_pushnil(L);
+        return 3;
+    }
+
+    static int sequenceNext(lua_State* L) {
+        Container* c = target(L, 1)->container;
+        return raise(L, guarded(L, [L, c] {
+            lua_Integer i = lua_isnil(L, 2) ? 1 : lua_tointeger(L, 2) + 1;
+            if (!c || static_cast<lua_Unsigned>(i) > std::ranges::size(*c)) {
+                lua_pushnil(L);
+                return 1;
+            }
+            lua_pushinteger(L, i);
+            pushElement(L, (*c)[static_cast<size_t>(i - 1)]);
+            return 2;
+        }));
+    }
+
+    // Steps past the element before returning it, so the script may clear
+    // the field it is visiting. After an insertion or erasure the iterator
+    // may be invalid (an unordered_map rehash), so the next element is
+    // looked up again by its key; after a rehash the remaining order differs.
+    static int mapNext(lua_State* L) {
+        Payload* payload = static_cast<Payload*>(lua_touserdata(L, lua_upvalueindex(2)));
+        auto* slot = static_cast<CursorSlot*>(lua_touserdata(L, lua_upvalueindex(1)));
+        return raise(L, guarded(L, [L, payload, slot] {
+            if (!*slot) {
+                throw std::runtime_error("LuaView pairs() cursor used after it was collected");
+            }
+            Cursor* cursor = &**slot;
+            Container* c = payload->container;
+            if (c && cursor->version != payload->version) {
+                cursor->next = cursor->nextKey ? c->find(*cursor->nextKey) : c->end();
+                if (cursor->nextKey && cursor->next == c->end()) {
+                    throw std::runtime_error("LuaView entry erased before pairs() reached it");
+                }
+                cursor->version = payload->version;
+            }
+            if (!c || cursor->next == c->end()) {
+                lua_pushnil(L);
+                return 1;
+            }
+            auto it = cursor->next++;
+            if (cursor->next != c->end()) {
+                cursor->nextKey = cursor->next->first;
+            } else {
+                cursor->nextKey.reset();
+            }
+            LuaFunctionCaller::pushToLuaStack(L, it->first);
+            LuaFunctionCaller::pushToLuaStack(L, it->second);
+            return 2;
+        }));
+    }
+
+    static void pushCursorMetatable(lua_State* L) {
+        if (lua_rawgetp(L, LUA_REGISTRYINDEX, &kCursorMetatableKey) != LUA_TNIL) {
+            return;
+        }
+        lua_pop(L, 1);
+        lua_createtable(L, 0, 2);
+        lua_pushliteral(L, "LuaView cursor");
+        lua_setfield(L, -2, "__metatable");
+        lua_pushcfunction(L, &LuaView::destroyCursor);
+        lua_setfield(L, -2, "__gc");
+        lua_pushvalue(L, -1);
+        lua_rawsetp(L, LUA_REGISTRYINDEX, &kCursorMetatableKey);
+    }
+
+    // Destroys the cursor at most once; an empty slot has nothing left to free
+    static int destroyCursor(lua_State* L) {
+        static_cast<CursorSlot*>(CheckLuaUserdata(L, 1, &kCursorMetatableKey, "LuaView cursor"))->reset();
+        return 0;
+    }
+
+    Container* container_;
+    mutable LuaLentUserdata userdata_;
+};
+
+template<typename Container>
+struct LuaLendsMemory<LuaView<Container>> : std::true_type {};
+
+#endif
@@ -0,0 +1,86 @@
+// LuaPoolAllocator: memory accounting of a pooled state, arena scopes with
+// objects that outlive them, and the handlers installed on pooled states.
+
+#include "lua_test.hpp"
+#include "lua_allocator.hpp"
+#include "lua_bindings.hpp"
+
+#include <string>
+#include <vector>
+
+static const char* kScript = R"(
+    function build(n) local t = {} for i = 1, n do t[i] = {i, tostring(i)} end return t end
+    function keep(n) kept = build(n) return #kept end
+    function checkKept(n) return #kept == n and kept[n][2] == tostring(n) end
+    function echo(v) return v end
+)";
+
+static void run(lua_State* L, const char* script) {
+    if (luaL_dostring(L, script) != LUA_OK) {
+        LuaTestFail(__FILE__, __LINE__, lua_tostring(L, -1));
+        lua_pop(L, 1);
+    }
+}
+
+static void testAccounting() {
+    LuaStatePtr state(NewPooledLuaState());
+    lua_State* L = state.get();
+    run(L, kScript);
+    LuaMemoryStats before = GetLuaMemoryStats(L);
+    CHECK(before.liveBytes > 0 && before.allocations > 0);
+    CallLuaFunction<int>(L, "keep", 10000);
+    LuaMemoryStats grown = GetLuaMemoryStats(L);
+    CHECK(grown.liveBytes > before.liveBytes);
+    CHECK(grown.peakBytes >= grown.liveBytes);
+    run(L, "kept = nil");
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    LuaMemoryStats collected = GetLuaMemoryStats(L);
+    CHECK(collected.liveBytes < grown.liveBytes);
+    CHECK(collected.frees > grown.frees);
+
+    // Round trip of a large value through the pooled state
+    std::vector<std::string> strings(5000, std::string(600, 's'));
+    CHECK(CallLuaFunction<std::vector<std::string>>(L, "echo", strings) == strings);
+}
+
+static void testArenaScope() {
+    LuaStatePtr state(NewPooledLuaState());
+    lua_State* L = state.get();
+    run(L, kScript);
+    {
+        LuaArenaScope arena(L);
+        CHECK(CallLuaFunction<int>(L, "keep", 5000) == 5000);
+        CHECK(GetLuaMemoryStats(L).arenaAllocations > 0);
+    }
+    // Objects created inside the scope and kept by the script stay valid
+    for (int round = 0; round < 3; ++round) {
+        LuaArenaScope arena(L);
+        CallLuaFunction<int>(L, "echo", 1);
+        CallLuaFunction<void>(L, "build", 1000);
+        lua_gc(L, LUA_GCCOLLECT, 0);
+    }
+    CHECK(CallLuaFunction<bool>(L, "checkKept", 5000));
+}
+
+static void testErrorPaths() {
+    lua_State* plain = luaL_newstate();
+    CHECK(GetLuaPoolAllocator(plain) == nullptr);
+    CHECK_THROWS(GetLuaMemoryStats(plain), std::runtime_error);
+    ClosePooledLuaState(plain);  // Also closes states without a pool
+
+    LuaStatePtr state(NewPooledLuaState());
+    lua_State* L = state.get();
+    run(L, kScript);
+    CHECK_THROWS(CallLuaFunction<int>(L, "missing"), std::runtime_error);
+    // A pooled state gets the default panic and warning handlers
+    lua_CFunction panic = lua_atpanic(L, nullptr);
+    CHECK(panic == &LuaDefaultHandlers::panic);
+    lua_atpanic(L, panic);
+}
+
+int main() {
+    testAccounting();
+    testArenaScope();
+    testErrorPaths();
+    return LuaTestResult();
+}
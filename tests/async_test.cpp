@@ -0,0 +1,128 @@
+// CallLuaFunctionAsync and async C++ functions: results completed later
+// from an event loop or synchronously, rejections caught and uncaught,
+// abandoned calls, and misuse outside an async call.
+
+#include "lua_test.hpp"
+#include "lua_async.hpp"
+
+#include <coroutine>
+#include <deque>
+#include <functional>
+#include <string>
+
+// Fire-and-forget coroutine, enough to drive the awaits below
+struct Task {
+    struct promise_type {
+        Task get_return_object() { return {}; }
+        std::suspend_never initial_suspend() { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+static std::deque<std::function<void()>> loop;
+
+static void drain() {
+    while (!loop.empty()) {
+        auto work = std::move(loop.front());
+        loop.pop_front();
+        work();
+    }
+}
+
+static const char* kScript = R"(
+    function work(i) local a = later(i) local b = later(0) return a + b + 1 end
+    function syncwork() return now() end
+    function caught() local ok = pcall(fail) local ok2 = pcall(throws, 1) return ok or ok2 end
+    function uncaught() fail() end
+    function plainyield() coroutine.yield() end
+)";
+
+static void registerFunctions(lua_State* L) {
+    RegisterAsyncCppFunction(L, "later", [](LuaPromise promise, long long x) {
+        loop.push_back([promise, x] {
+            promise.resolve(x * 2);      // false once the call was abandoned
+            CHECK(!promise.resolve(0));  // The first completion wins
+        });
+    });
+    RegisterAsyncCppFunction(L, "now", [](LuaPromise promise) { promise.resolve(7, std::string("x")); });
+    RegisterAsyncCppFunction(L, "fail", [](LuaPromise promise) { loop.push_back([promise] { promise.reject("boom"); }); });
+    RegisterAsyncCppFunction(L, "throws", [](LuaPromise, int) { throw std::runtime_error("bad"); });
+}
+
+static int finished = 0;
+
+static Task awaitWork(lua_State* L, int i) {
+    long long value = co_await CallLuaFunctionAsync<long long>(L, "work", i);
+    CHECK(value == i * 2 + 1);
+    ++finished;
+}
+
+static Task awaitSync(lua_State* L) {
+    auto [a, b] = co_await CallLuaFunctionAsync<int, std::string>(L, "syncwork");
+    CHECK(a == 7 && b == "x");
+    ++finished;
+}
+
+static Task awaitErrors(lua_State* L) {
+    CHECK(!co_await CallLuaFunctionAsync<bool>(L, "caught"));
+    try {
+        co_await CallLuaFunctionAsync<>(L, "uncaught");
+        CHECK(false);
+    } catch (const std::runtime_error& e) {
+        CHECK(std::string(e.what()).find("boom") != std::string::npos);
+    }
+    try {
+        co_await CallLuaFunctionAsync<>(L, "plainyield");
+        CHECK(false);
+    } catch (const std::runtime_error&) {
+    }
+    ++finished;
+}
+
+static void testCompletion() {
+    LuaTestState L;
+    registerFunctions(L);
+    L.run(kScript);
+    int top = lua_gettop(L);
+    finished = 0;
+    for (int i = 0; i < 100; ++i) {
+        awaitWork(L, i);
+    }
+    awaitSync(L);
+    CHECK(finished == 1);  // Only the synchronous call is done before the loop runs
+    awaitErrors(L);
+    drain();
+    CHECK(finished == 102);
+    CHECK(lua_gettop(L) == top);
+}
+
+static void testAbandonedCall() {
+    LuaTestState L;
+    registerFunctions(L);
+    L.run(kScript);
+    {
+        auto call = CallLuaFunctionAsync<long long>(L, "work", 1);
+        CHECK(!call.done());
+    }
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    drain();  // Completing the stale promise does nothing
+    CHECK(lua_gettop(L) == 0);
+}
+
+static void testOutsideAsyncCall() {
+    LuaTestState L;
+    registerFunctions(L);
+    lua_getglobal(L, "now");
+    CHECK(lua_pcall(L, 0, 0, 0) != LUA_OK);
+    lua_pop(L, 1);
+    CHECK_THROWS(CallLuaFunction<int>(L, "now"), std::runtime_error);
+}
+
+int main() {
+    testCompletion();
+    testAbandonedCall();
+    testOutsideAsyncCall();
+    return LuaTestResult();
+}
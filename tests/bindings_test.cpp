@@ -0,0 +1,141 @@
+// Round trips through the core marshalling of lua_bindings.hpp, the error
+// paths of the call functions, and the compile-time guarantee that call
+// arguments are never copied.
+
+#include "lua_test.hpp"
+#include "lua_bindings.hpp"
+
+#include <map>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct Event {
+    lua_Integer id;
+    std::string kind;
+    double score;
+    std::optional<std::string> tag;
+};
+LUA_STRUCT(Event, id, kind, score, tag)
+
+// Pushes itself and cannot be copied: every call below only compiles if no
+// layer between the caller and pushToLuaStack takes its argument by value
+struct NoCopy {
+    NoCopy() = default;
+    NoCopy(const NoCopy&) = delete;
+    NoCopy& operator=(const NoCopy&) = delete;
+
+    void toLuaStack(lua_State* L) const {
+        lua_pushinteger(L, 42);
+    }
+};
+
+static const char* kScript = R"(
+    function echo(...) return ... end
+    function count(t) local n = 0 for _ in pairs(t) do n = n + 1 end return n end
+    function fail(message) error(message) end
+    function numbers(n) local t = {} for i = 1, n do t[i] = i * 10 end return t end
+    function mixed() return {1, 2, "three", 4} end
+    function rescore(e) e.score = e.score * 2 return e end
+)";
+
+static void testScalarRoundTrip() {
+    LuaTestState L(kScript);
+    CHECK(CallLuaFunction<int>(L, "echo", 7) == 7);
+    CHECK(CallLuaFunction<lua_Integer>(L, "echo", LUA_MININTEGER) == LUA_MININTEGER);
+    CHECK(CallLuaFunction<double>(L, "echo", 2.5) == 2.5);
+    CHECK(CallLuaFunction<bool>(L, "echo", false) == false);
+    CHECK(CallLuaFunction<std::string>(L, "echo", "hello") == "hello");
+    CHECK(CallLuaFunction<std::string>(L, "echo", std::string("with\0nul", 8)).size() == 8);
+    auto [a, b, c] = CallLuaFunction<int, std::string, bool>(L, "echo", 1, "two", true);
+    CHECK(a == 1 && b == "two" && c);
+    CHECK(lua_gettop(L) == 0);
+}
+
+static void testCharBuffers() {
+    LuaTestState L(kScript);
+    char terminated[8] = {'a', 'b', '\0', 'z'};
+    char full[3] = {'x', 'y', 'z'};
+    CHECK(CallLuaFunction<std::string>(L, "echo", terminated) == "ab");
+    CHECK(CallLuaFunction<std::string>(L, "echo", full) == "xyz");
+    String<4> fixed = {'q', 'r', 's', 't'};
+    CHECK(CallLuaFunction<std::string>(L, "echo", fixed) == "qrst");
+}
+
+static void testContainerRoundTrip() {
+    LuaTestState L(kScript);
+    std::vector<int> list{1, 2, 3};
+    CHECK(CallLuaFunction<std::vector<int>>(L, "echo", list) == list);
+    std::unordered_map<std::string, int> map{{"a", 1}, {"b", 2}};
+    CHECK((CallLuaFunction<std::unordered_map<std::string, int>>(L, "echo", map) == map));
+    CHECK(CallLuaFunction<int>(L, "count", map) == 2);
+    std::map<int, std::vector<std::string>> nested{{1, {"x"}}, {2, {"y", "z"}}};
+    CHECK((CallLuaFunction<std::map<int, std::vector<std::string>>>(L, "echo", nested) == nested));
+    CHECK(CallLuaFunction<std::optional<int>>(L, "echo", std::optional<int>{}) == std::nullopt);
+    CHECK(CallLuaFunction<std::optional<int>>(L, "echo", std::optional<int>{5}) == 5);
+    CHECK(CallLuaFunction<std::vector<int>>(L, "numbers", 1000).size() == 1000);
+}
+
+static void testStructRoundTrip() {
+    LuaTestState L(kScript);
+    Event e = CallLuaFunction<Event>(L, "rescore", Event{1, "click", 0.5, std::nullopt});
+    CHECK(e.id == 1 && e.kind == "click" && e.score == 1.0 && !e.tag);
+    std::vector<Event> events = CallLuaFunction<std::vector<Event>>(L, "echo", std::vector<Event>{{2, "a", 1, "t"}, {3, "b", 2, std::nullopt}});
+    CHECK(events.size() == 2 && events[0].tag == "t" && events[1].id == 3);
+}
+
+static void testErrorPaths() {
+    LuaTestState L(kScript);
+    CHECK_THROWS(CallLuaFunction<int>(L, "missing"), std::runtime_error);
+    CHECK_THROWS(CallLuaFunction<void>(L, "fail", "boom"), std::runtime_error);
+    CHECK_THROWS(CallLuaFunction<int>(L, "echo", "not a number"), std::runtime_error);
+    CHECK_THROWS(CallLuaFunction<std::vector<int>>(L, "mixed"), std::runtime_error);
+    CHECK_THROWS(CallLuaFunction<Event>(L, "echo", 5), std::runtime_error);
+    CHECK(lua_gettop(L) == 0);
+    try {
+        CallLuaFunction<void>(L, "fail", "specific message");
+    } catch (const std::runtime_error& e) {
+        CHECK(std::string(e.what()).find("specific message") != std::string::npos);
+    }
+    // The state stays usable after every failure
+    CHECK(CallLuaFunction<int>(L, "echo", 3) == 3);
+}
+
+static void testCallInto() {
+    LuaTestState L(kScript);
+    std::vector<int> out;
+    out.reserve(64);
+    const int* storage = out.data();
+    CallLuaFunctionInto(L, "numbers", out, 5);
+    CHECK(out.size() == 5 && out[4] == 50 && out.data() == storage);
+    // A failed decode leaves a partially decoded value, never a dangling one
+    std::vector<int> partial{9, 9, 9, 9, 9, 9};
+    CHECK_THROWS(CallLuaFunctionInto(L, "mixed", partial), std::runtime_error);
+    CHECK(partial.size() <= 4 && partial.size() >= 2 && partial[0] == 1 && partial[1] == 2);
+    CHECK(lua_gettop(L) == 0);
+}
+
+static void testArgumentsAreNotCopied() {
+    LuaTestState L(kScript);
+    NoCopy value;
+    const NoCopy& ref = value;
+    CHECK(CallLuaFunction<int>(L, "echo", value) == 42);
+    CHECK(CallLuaFunction<int>(L, "echo", ref) == 42);
+    CHECK(CallLuaFunction<int>(L, "echo", std::cref(value)) == 42);
+    LuaFunctionRef echo(L, "echo");
+    CHECK(CallLuaFunction<int>(echo, value) == 42);
+    LuaFunction<int> typed(L, "echo");
+    CHECK(typed(value) == 42);
+}
+
+int main() {
+    testScalarRoundTrip();
+    testCharBuffers();
+    testContainerRoundTrip();
+    testStructRoundTrip();
+    testErrorPaths();
+    testCallInto();
+    testArgumentsAreNotCopied();
+    return LuaTestResult();
+}
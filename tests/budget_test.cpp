@@ -0,0 +1,102 @@
+// Execution budgets: instruction and time limits, errors a script tries to
+// swallow, coroutines created before and during the call, and the state
+// left behind.
+
+#include "lua_test.hpp"
+#include "lua_budget.hpp"
+
+#include <chrono>
+
+using namespace std::chrono_literals;
+
+static const char* kScript = R"(
+    local resume = coroutine.resume
+    old = coroutine.create(function() while true do end end)
+    oldWrap = coroutine.wrap(function() while true do end end)
+    function spin() while true do end end
+    function swallow() while true do pcall(spin) end end
+    function resumeOld() return coroutine.resume(old) end
+    function resumeNew() return coroutine.resume(coroutine.create(spin)) end
+    function resumeSaved() return resume(coroutine.create(spin)) end
+    function callOldWrap() return oldWrap() end
+    function sum(n) local s = 0 for i = 1, n do s = s + i end return s end
+    function generator() local g = coroutine.wrap(function() for i = 1, 3 do coroutine.yield(i) end end) return g() + g() + g() end
+)";
+
+static void testInstructionLimit() {
+    LuaTestState L(kScript);
+    LuaBudgetStats stats;
+    LuaBudget budget{.instructions = 100000, .stats = &stats};
+    try {
+        CallLuaFunctionWithBudget<>(L, budget, "spin");
+        CHECK(false);
+    } catch (const LuaBudgetExceeded& e) {
+        CHECK(e.limit() == LuaBudgetLimit::Instructions);
+        CHECK(e.instructions() >= 100000);
+    }
+    CHECK_THROWS(CallLuaFunctionWithBudget<>(L, budget, "swallow"), LuaBudgetExceeded);
+    CHECK(CallLuaFunctionWithBudget<lua_Integer>(L, budget, "sum", 100) == 5050);
+    CHECK(stats.snapshot().calls == 3 && stats.snapshot().exceeded == 2);
+
+    // No hook is left behind
+    CHECK(lua_gethook(L) == nullptr);
+    CHECK(CallLuaFunction<lua_Integer>(L, "sum", 1000000) == 500000500000);
+    CHECK(lua_gettop(L) == 0);
+}
+
+static void testDeadline() {
+    LuaTestState L(kScript);
+    auto start = std::chrono::steady_clock::now();
+    try {
+        CallLuaFunctionWithBudget<>(L, LuaBudget{.timeout = 20ms}, "spin");
+        CHECK(false);
+    } catch (const LuaBudgetExceeded& e) {
+        CHECK(e.limit() == LuaBudgetLimit::Deadline);
+    }
+    CHECK(std::chrono::steady_clock::now() - start < 5s);
+}
+
+static void testCoroutines() {
+    LuaBudget budget{.instructions = 100000, .timeout = 5s};
+    {
+        LuaTestState L(kScript);
+        CHECK_THROWS(CallLuaFunctionWithBudget<>(L, budget, "resumeOld"), LuaBudgetExceeded);
+        CHECK_THROWS(CallLuaFunctionWithBudget<>(L, budget, "resumeNew"), LuaBudgetExceeded);
+        CHECK(CallLuaFunctionWithBudget<int>(L, budget, "generator") == 6);
+        // The library functions are restored after the call
+        lua_getglobal(L, "coroutine");
+        lua_getfield(L, -1, "resume");
+        CHECK(lua_tocfunction(L, -1) != nullptr);
+        lua_pop(L, 2);
+        CHECK(CallLuaFunction<int>(L, "generator") == 6);
+    }
+    {
+        // References saved before the call need the permanent wrappers
+        LuaTestState L;
+        LuaBudgetGuard::installCoroutineWrappers(L);
+        L.run(kScript);
+        CHECK_THROWS(CallLuaFunctionWithBudget<>(L, budget, "resumeSaved"), LuaBudgetExceeded);
+        CHECK_THROWS(CallLuaFunctionWithBudget<>(L, budget, "callOldWrap"), LuaBudgetExceeded);
+        CHECK(CallLuaFunctionWithBudget<int>(L, budget, "generator") == 6);
+    }
+}
+
+static void testNestedGuards() {
+    LuaTestState L(kScript);
+    LuaBudgetGuard outer(L, LuaBudget{.instructions = 1000000000});
+    {
+        LuaBudgetGuard inner(L, LuaBudget{.instructions = 1000});
+        CHECK_THROWS(CallLuaFunction<>(L, "spin"), std::runtime_error);
+        CHECK(inner.exceeded());
+    }
+    CHECK(!outer.exceeded());
+    CHECK(CallLuaFunction<lua_Integer>(L, "sum", 10) == 55);
+}
+
+int main() {
+    testInstructionLimit();
+    testDeadline();
+    testCoroutines();
+    testNestedGuards();
+    return LuaTestResult();
+}
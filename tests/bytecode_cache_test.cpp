@@ -0,0 +1,122 @@
+// LuaBytecodeCache: compile once then load from disk, exported functions,
+// damaged entries recompiled, and sources that do not compile.
+
+#include "lua_test.hpp"
+#include "lua_bytecode_cache.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+static const char* kSource = R"(
+    local M = {}
+    function M.square(x) return x * x end
+    function M.greet(name) return "hello " .. name end
+    return M
+)";
+
+// Fresh cache directory under the system temp directory, removed on scope exit
+class TempDirectory {
+public:
+    explicit TempDirectory(const char* name)
+        : path_(std::filesystem::temp_directory_path() / name) {
+        std::filesystem::remove_all(path_);
+    }
+
+    ~TempDirectory() {
+        std::error_code ec;
+        std::filesystem::remove_all(path_, ec);
+    }
+
+    const std::filesystem::path& path() const { return path_; }
+
+private:
+    std::filesystem::path path_;
+};
+
+static void rewrite(const std::filesystem::path& path, const std::string& contents) {
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << contents;
+}
+
+static std::string contentsOf(const std::filesystem::path& path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), {});
+}
+
+static void testRoundTrip() {
+    TempDirectory directory("lua_bindings_bytecode_cache_test");
+    LuaBytecodeCache cache(directory.path());
+    {
+        LuaTestState L;
+        LuaScript script = cache.run(L, kSource, "=module");
+        CHECK(!script.fromCache());
+        CHECK(script.functions().size() == 2);
+        CHECK(CallLuaFunction<int>(script.function("square"), 7) == 49);
+    }
+    CHECK(std::filesystem::exists(cache.pathFor(kSource, "=module")));
+    {
+        LuaTestState L;
+        LuaScript script = cache.run(L, kSource, "=module", {"greet"});
+        CHECK(script.fromCache());
+        CHECK(CallLuaFunction<std::string>(script.function("greet"), "lua") == "hello lua");
+        CHECK_THROWS(script.function("square"), std::runtime_error);
+        CHECK(lua_gettop(L) == 0);
+    }
+    CHECK(cache.misses() == 1 && cache.hits() == 1);
+
+    // Another chunk name is another entry
+    CHECK(cache.pathFor(kSource, "=module") != cache.pathFor(kSource, "=other"));
+
+    // Globals are exported when the chunk returns nothing
+    LuaTestState L;
+    LuaScript globals = cache.run(L, "function twice(x) return 2 * x end", "=globals", {"twice"});
+    CHECK(CallLuaFunction<int>(globals.function("twice"), 21) == 42);
+
+    // Bytecode for another state, e.g. a pool's init chunk
+    std::string bytecode = cache.bytecode(kSource, "=module");
+    CHECK(!bytecode.empty() && bytecode[0] == '\x1b');
+    CHECK(luaL_loadbufferx(L, bytecode.data(), bytecode.size(), "=module", "b") == LUA_OK);
+    lua_pop(L, 1);
+}
+
+static void testDamagedEntries() {
+    TempDirectory directory("lua_bindings_bytecode_cache_damaged");
+    LuaBytecodeCache cache(directory.path());
+    std::filesystem::path path = cache.pathFor(kSource, "=module");
+    {
+        LuaTestState L;
+        cache.run(L, kSource, "=module");
+    }
+    std::string entry = contentsOf(path);
+
+    std::string flipped = entry;
+    flipped[flipped.size() / 2] ^= 0x55;
+    for (const std::string& damaged : {entry.substr(0, entry.size() / 2), flipped, entry.substr(0, 4), std::string()}) {
+        rewrite(path, damaged);
+        LuaTestState L;
+        LuaScript script = cache.run(L, kSource, "=module");
+        CHECK(!script.fromCache());
+        CHECK(CallLuaFunction<int>(script.function("square"), 3) == 9);
+        CHECK(contentsOf(path) == entry);  // Replaced by a good entry
+    }
+    CHECK(cache.hits() == 0 && cache.misses() == 5);
+}
+
+static void testErrorPaths() {
+    TempDirectory directory("lua_bindings_bytecode_cache_errors");
+    LuaBytecodeCache cache(directory.path());
+    LuaTestState L;
+    CHECK_THROWS(cache.run(L, "return (", "=broken"), std::runtime_error);
+    CHECK_THROWS(cache.run(L, "error('at load')", "=fails"), std::runtime_error);
+    CHECK_THROWS(cache.run(L, "return {}", "=empty", {"missing"}), std::runtime_error);
+    CHECK(lua_gettop(L) == 0);
+    CHECK(!std::filesystem::exists(cache.pathFor("return (", "=broken")));
+}
+
+int main() {
+    testRoundTrip();
+    testDamagedEntries();
+    testErrorPaths();
+    return LuaTestResult();
+}
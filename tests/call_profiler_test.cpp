@@ -0,0 +1,125 @@
+// LuaCallProfiler: calls and errors recorded for tracked names and handles,
+// counters merged across threads, and the exported formats.
+
+#include "lua_test.hpp"
+#include "lua_call_profiler.hpp"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+static const char* kScript = R"(
+    function score(x) return x * 2 end
+    function total(values) local s = 0 for _, v in ipairs(values) do s = s + v end return s end
+    function fail() error("failed") end
+)";
+
+static const LuaCallProfiler::Stats* find(const std::vector<LuaCallProfiler::Stats>& stats, std::string_view name) {
+    for (const auto& s : stats) {
+        if (s.function == name) {
+            return &s;
+        }
+    }
+    return nullptr;
+}
+
+static void testRecording() {
+    LuaTestState L(kScript);
+    LuaCallProfiler profiler;
+    auto score = profiler.track("score");
+    LuaFunctionRef totalRef(L, "total");
+    auto total = profiler.track(totalRef);
+    auto fail = profiler.track("fail");
+
+    for (int i = 0; i < 10; ++i) {
+        CHECK(CallLuaFunction<int>(L, score, i) == 2 * i);
+    }
+    CHECK(CallLuaFunction<int>(L, total, std::vector<int>{1, 2, 3}) == 6);
+    CHECK_THROWS(CallLuaFunction<void>(L, fail), std::runtime_error);
+    CHECK_THROWS(CallLuaFunction<std::string>(L, score, 1), std::runtime_error);  // Result of the wrong type
+    CallLuaFunction<int>(L, "score", 1);  // Untracked
+    CHECK(lua_gettop(L) == 0);
+
+    auto stats = profiler.snapshot();
+    CHECK(stats.size() == 3);
+    const auto* s = find(stats, "score");
+    CHECK(s && s->calls == 11 && s->errors == 1);
+    CHECK(s && s->elements == 21);  // The failed read still pushed its argument
+    uint64_t histogram = 0;
+    for (uint64_t count : s->latency) {
+        histogram += count;
+    }
+    CHECK(histogram == 11);
+    const auto* t = find(stats, "total");
+    CHECK(t && t->calls == 1 && t->errors == 0 && t->elements == 4);
+    const auto* f = find(stats, "fail");
+    CHECK(f && f->calls == 1 && f->errors == 1);
+
+    // Tracking the same name again shares its counters
+    auto again = profiler.track("score");
+    CallLuaFunction<int>(L, again, 1);
+    CHECK(find(profiler.snapshot(), "score")->calls == 12);
+}
+
+static void testThreads() {
+    LuaCallProfiler profiler;
+    auto score = profiler.track("score");
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&score] {
+            LuaTestState L(kScript);
+            for (int i = 0; i < 1000; ++i) {
+                CallLuaFunction<int>(L, score, i);
+            }
+        });
+    }
+    // Snapshots while the threads record
+    for (int i = 0; i < 20; ++i) {
+        auto stats = profiler.snapshot();
+        CHECK(stats.size() == 1 && stats[0].calls <= 4000);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    CHECK(profiler.snapshot()[0].calls == 4000);
+
+    // A new profiler does not see the counters of a destroyed one
+    {
+        LuaCallProfiler first;
+        LuaTestState L(kScript);
+        CallLuaFunction<int>(L, first.track("score"), 1);
+    }
+    LuaCallProfiler second;
+    LuaTestState L(kScript);
+    CallLuaFunction<int>(L, second.track("score"), 1);
+    CHECK(second.snapshot()[0].calls == 1);
+}
+
+static void testFormats() {
+    LuaTestState L(kScript);
+    LuaCallProfiler profiler;
+    CHECK(profiler.json() == "[]\n");
+    auto score = profiler.track("score");
+    CallLuaFunction<int>(L, score, 1);
+
+    std::string prometheus = profiler.prometheus();
+    for (const char* metric : {"lua_call_total", "lua_call_errors_total", "lua_call_phase_seconds_total", "lua_call_duration_seconds_bucket"}) {
+        CHECK(prometheus.find(metric) != std::string::npos);
+    }
+    CHECK(prometheus.find("+Inf") != std::string::npos);
+    std::string json = profiler.json();
+    CHECK(json.front() == '[' && json.find("score") != std::string::npos && json.find("+Inf") != std::string::npos);
+
+    // Names are escaped in both formats
+    auto odd = profiler.track("we\"ird\\name\n");
+    CHECK(profiler.prometheus().find("we\\\"ird\\\\name\\n") != std::string::npos);
+    CHECK(profiler.json().find("we\\\"ird\\\\name\\n") != std::string::npos);
+    (void)odd;
+}
+
+int main() {
+    testRecording();
+    testThreads();
+    testFormats();
+    return LuaTestResult();
+}
@@ -0,0 +1,102 @@
+// C++ functions called from Lua: argument and result round trips, member
+// and compile-time functions, exceptions and bad arguments turned into Lua
+// errors, and the lifetime of stored callables.
+
+#include "lua_test.hpp"
+#include "lua_cpp_function.hpp"
+
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+static double distance(double x, double y) {
+    return x * x + y * y;
+}
+
+struct Counter {
+    int value = 0;
+    int add(int n) { return value += n; }
+};
+
+static void testRoundTrip() {
+    LuaTestState L;
+    RegisterCppFunction(L, "distance", &distance);
+    RegisterCppFunction<&distance>(L, "distanceStatic");
+    RegisterCppFunction(L, "split", [](std::string_view text) {
+        return std::make_tuple(std::string(text.substr(0, 1)), static_cast<lua_Integer>(text.size()));
+    });
+    RegisterCppFunction(L, "reverse", [](std::vector<int> values) {
+        return std::vector<int>(values.rbegin(), values.rend());
+    });
+    RegisterCppFunction(L, "top", [](lua_State* state, int extra) { return lua_gettop(state) + extra; });
+    Counter counter;
+    RegisterCppFunction(L, "add", &Counter::add, &counter);
+    L.run(R"(
+        function check()
+            local first, size = split("hello")
+            local r = reverse({1, 2, 3})
+            return distance(3, 4) == 25 and distanceStatic(1, 1) == 2
+               and first == "h" and size == 5
+               and r[1] == 3 and r[3] == 1
+               and top(10) >= 11
+               and add(2) == 2 and add(3) == 5
+        end
+    )");
+    CHECK(CallLuaFunction<bool>(L, "check"));
+    CHECK(counter.value == 5);
+}
+
+static void testErrors() {
+    LuaTestState L;
+    RegisterCppFunction(L, "distance", &distance);
+    RegisterCppFunction(L, "throws", [](int n) -> int { throw std::runtime_error("thrown " + std::to_string(n)); });
+    L.run(R"(
+        function badArgument() local ok, e = pcall(distance, "x", 1) return not ok and e:find("bad argument #1") ~= nil end
+        function caught() local ok, e = pcall(throws, 3) return not ok and e:find("thrown 3") ~= nil end
+        function uncaught() return throws(4) end
+    )");
+    CHECK(CallLuaFunction<bool>(L, "badArgument"));
+    CHECK(CallLuaFunction<bool>(L, "caught"));
+    CHECK_THROWS(CallLuaFunction<int>(L, "uncaught"), std::runtime_error);
+    CHECK(lua_gettop(L) == 0);
+}
+
+static void testLifetime() {
+    auto shared = std::make_shared<int>(0);
+    {
+        LuaTestState L;
+        RegisterCppFunction(L, "bump", [shared](int n) { return *shared += n; });
+        CHECK(shared.use_count() == 2);
+        L.run(R"(
+            function attack()
+                local _, box = debug.getupvalue(bump, 1)
+                if getmetatable(box) ~= "C++ function" then return false end
+                local gc = debug.getmetatable(box).__gc
+                if pcall(gc, nil) or pcall(gc, io.stdout) then return false end
+                bump(1)
+                gc(box)
+                gc(box)
+                return not pcall(bump, 1)
+            end
+        )");
+        CHECK(CallLuaFunction<bool>(L, "attack"));
+        CHECK(*shared == 1);
+        CHECK(shared.use_count() == 1);  // Destroyed once by the explicit __gc
+    }
+    CHECK(shared.use_count() == 1);
+    {
+        LuaTestState L;
+        PushCppFunction(L, [shared](int n) { return n; });
+        lua_pop(L, 1);
+        lua_gc(L, LUA_GCCOLLECT, 0);
+        CHECK(shared.use_count() == 1);
+    }
+}
+
+int main() {
+    testRoundTrip();
+    testErrors();
+    testLifetime();
+    return LuaTestResult();
+}
@@ -0,0 +1,93 @@
+// LuaGcPolicy and the collector helpers: suspended calls, the collection a
+// call pays once suspendLimit is reached, idle stepping in both modes, and
+// nested pauses.
+
+#include "lua_test.hpp"
+#include "lua_gc_policy.hpp"
+
+#include <chrono>
+
+using namespace std::chrono_literals;
+
+static const char* kScript = R"(
+    function churn(n) local last for i = 1, n do last = {i, tostring(i) .. "xxxxxxxxxxxxxxxx"} end return n end
+    function fail() error("call failed") end
+)";
+
+static void testSuspendedCalls() {
+    LuaTestState L(kScript);
+    LuaGcPolicy gc(L, {.suspendLimit = 0});
+    gc.collect();
+    CHECK(gc.call<int>("churn", 20000) == 20000);
+    const LuaGcReport& report = gc.lastCall();
+    CHECK(report.suspended && !report.collected);
+    CHECK(report.memoryDelta > 0);
+    CHECK(lua_gc(L, LUA_GCISRUNNING, 0) != 0);  // Restarted after the call
+
+    // The garbage is paid for by idle()
+    size_t grown = GetLuaGcBytes(L);
+    int cycles = 0;
+    for (int i = 0; i < 1000 && cycles == 0; ++i) {
+        cycles += gc.idle(1ms).cycleFinished ? 1 : 0;
+    }
+    CHECK(cycles == 1);
+    CHECK(GetLuaGcBytes(L) < grown);
+    CHECK(gc.stats().calls == 1 && gc.stats().suspendedCalls == 1);
+}
+
+static void testSuspendLimit() {
+    LuaTestState L(kScript);
+    LuaGcPolicy gc(L, {.suspendLimit = size_t(1) << 20});
+    gc.collect();
+    gc.call<int>("churn", 50000);
+    CHECK(!gc.lastCall().collected);
+    size_t before = GetLuaGcBytes(L);
+    gc.call<int>("churn", 10);
+    CHECK(gc.lastCall().collected && gc.lastCall().suspended);
+    CHECK(GetLuaGcBytes(L) < before);
+    CHECK(gc.stats().limitCollections == 1);
+}
+
+static void testErrorInCall() {
+    LuaTestState L(kScript);
+    LuaGcPolicy gc(L);
+    CHECK_THROWS(gc.call<void>("fail"), std::runtime_error);
+    CHECK(lua_gc(L, LUA_GCISRUNNING, 0) != 0);
+    CHECK(gc.stats().calls == 1);
+}
+
+static void testStepModes() {
+    LuaTestState L(kScript);
+    CallLuaFunction<int>(L, "churn", 20000);
+    LuaGcStepResult incremental = StepLuaGc(L, LuaGcMode::Incremental, 50ms);
+    CHECK(incremental.steps >= 1);
+
+#if LUA_VERSION_NUM >= 504
+    LuaGcPolicy gc(L, {.mode = LuaGcMode::Generational});
+    CallLuaFunction<int>(L, "churn", 20000);
+    LuaGcStepResult generational = gc.idle(50ms);
+    CHECK(generational.steps == 1 && generational.cycleFinished);
+#endif
+}
+
+static void testNestedPauses() {
+    LuaTestState L;
+    {
+        LuaGcPause outer(L);
+        {
+            LuaGcPause inner(L);
+            CHECK(lua_gc(L, LUA_GCISRUNNING, 0) == 0);
+        }
+        CHECK(lua_gc(L, LUA_GCISRUNNING, 0) == 0);
+    }
+    CHECK(lua_gc(L, LUA_GCISRUNNING, 0) != 0);
+}
+
+int main() {
+    testSuspendedCalls();
+    testSuspendLimit();
+    testErrorInCall();
+    testStepModes();
+    testNestedPauses();
+    return LuaTestResult();
+}
@@ -0,0 +1,102 @@
+// LuaHotReloader: versions swapped in at safe points, references re-pointed,
+// preserved state, and reloads that fail to compile or to run.
+
+#include "lua_test.hpp"
+#include "lua_cpp_function.hpp"
+#include "lua_hot_reload.hpp"
+
+#include <string>
+#include <thread>
+
+static const char* kVersion1 = R"(
+    counter = 0
+    M = {}
+    function M.value() return 1 end
+    function update(n) counter = counter + n return counter end
+    function kind() return "v1" end
+)";
+
+static const char* kVersion2 = R"(
+    counter = 0
+    M = {}
+    function M.value() return 2 end
+    function update(n) counter = counter + 10 * n return counter end
+    function kind() return "v2" end
+)";
+
+static void testSwap() {
+    LuaTestState L(kVersion1);
+    LuaHotReloader reloader;
+    LuaReloadableFunction<int> update(reloader, L, "update");
+    LuaFunctionRef value(L, "M.value");
+    CHECK(update(1) == 1);
+
+    CHECK(reloader.reload(kVersion2, "=game", {"counter"}) == 1);
+    CHECK(reloader.appliedVersion(L) == 0);
+    CHECK(update(1) == 11);  // Swapped before the call, counter preserved
+    CHECK(reloader.appliedVersion(L) == 1);
+    CHECK(CallLuaFunction<int>(value) == 2);  // Existing handle re-pointed
+    CHECK(CallLuaFunction<std::string>(L, "kind") == "v2");
+
+    // Without preserve the new chunk's value wins
+    reloader.reload(kVersion2, "=game");
+    CHECK(reloader.poll(L) == 2);
+    CHECK(update(1) == 10);
+    CHECK(lua_gettop(L) == 0);
+}
+
+static void testFailedReloads() {
+    LuaTestState L(kVersion1);
+    LuaHotReloader reloader;
+    CHECK_THROWS(reloader.reload("function broken(", "=broken"), std::runtime_error);
+    CHECK(reloader.version() == 0);
+
+    // Compiles but fails at run time: skipped, old version keeps running
+    reloader.reload("function kind() return 'bad' end error('boom')", "=fails");
+    CHECK(reloader.poll(L) == 1);
+    CHECK(reloader.lastError().find("boom") != std::string::npos);
+    CHECK(CallLuaFunction<std::string>(L, "kind") == "v1");
+    CHECK(lua_gettop(L) == 0);
+}
+
+static void testSafePoint() {
+    LuaTestState L(kVersion1);
+    LuaHotReloader reloader;
+    reloader.reload(kVersion2, "=game");
+    // poll() from inside a running Lua function does not swap
+    RegisterCppFunction(L, "pollInside", [&reloader](lua_State* state) {
+        return static_cast<lua_Integer>(reloader.poll(state));
+    });
+    L.run("function inside() return pollInside(), kind() end");
+    auto [applied, kind] = CallLuaFunction<lua_Integer, std::string>(L, "inside");
+    CHECK(applied == 0 && kind == "v1");
+    CHECK(reloader.poll(L) == 1);
+    CHECK(CallLuaFunction<std::string>(L, "kind") == "v2");
+}
+
+static void testConcurrentPublish() {
+    LuaTestState L(kVersion1);
+    LuaHotReloader reloader;
+    LuaReloadableFunction<std::string> kind(reloader, L, "kind");
+    std::thread publisher([&reloader] {
+        for (int i = 0; i < 50; ++i) {
+            reloader.reload(i % 2 ? kVersion1 : kVersion2, "=game");
+        }
+    });
+    for (int i = 0; i < 200; ++i) {
+        std::string result = kind();
+        CHECK(result == "v1" || result == "v2");
+    }
+    publisher.join();
+    kind();
+    CHECK(reloader.appliedVersion(L) == 50);
+    CHECK(kind() == "v1");
+}
+
+int main() {
+    testSwap();
+    testFailedReloads();
+    testSafePoint();
+    testConcurrentPublish();
+    return LuaTestResult();
+}
@@ -0,0 +1,81 @@
+#ifndef LUA_LUATEST
+#define LUA_LUATEST
+
+#include <lua.hpp>
+#include <cstdio>
+#include <exception>
+
+// Minimal checks for the test executables. A failed check prints its
+// location and the run goes on; main returns LuaTestResult(), non-zero if
+// any check failed, which is what ctest looks at.
+inline int& LuaTestFailures() {
+    static int failures = 0;
+    return failures;
+}
+
+inline void LuaTestFail(const char* file, int line, const char* what) {
+    std::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, what);
+    ++LuaTestFailures();
+}
+
+inline int LuaTestResult() {
+    if (LuaTestFailures() > 0) {
+        std::fprintf(stderr, "%d check(s) failed\n", LuaTestFailures());
+        return 1;
+    }
+    return 0;
+}
+
+#define CHECK(condition)                                  \
+    do {                                                  \
+        if (!(condition)) {                               \
+            LuaTestFail(__FILE__, __LINE__, #condition);  \
+        }                                                 \
+    } while (0)
+
+// The expression must throw Exception (or a type derived from it)
+#define CHECK_THROWS(expression, Exception)                                            \
+    do {                                                                               \
+        bool luaTestThrown = false;                                                    \
+        try {                                                                          \
+            (void)(expression);                                                        \
+        } catch (const Exception&) {                                                   \
+            luaTestThrown = true;                                                      \
+        } catch (const std::exception& e) {                                            \
+            LuaTestFail(__FILE__, __LINE__, e.what());                                 \
+            luaTestThrown = true;                                                      \
+        }                                                                              \
+        if (!luaTestThrown) {                                                          \
+            LuaTestFail(__FILE__, __LINE__, #expression " did not throw " #Exception); \
+        }                                                                              \
+    } while (0)
+
+// lua_State with the standard libraries and a script loaded, closed on scope exit
+class LuaTestState {
+public:
+    explicit LuaTestState(const char* script = "") : L_(luaL_newstate()) {
+        luaL_openlibs(L_);
+        run(script);
+    }
+
+    LuaTestState(const LuaTestState&) = delete;
+    LuaTestState& operator=(const LuaTestState&) = delete;
+
+    ~LuaTestState() {
+        lua_close(L_);
+    }
+
+    void run(const char* script) {
+        if (luaL_dostring(L_, script) != LUA_OK) {
+            LuaTestFail(__FILE__, __LINE__, lua_tostring(L_, -1));
+            lua_pop(L_, 1);
+        }
+    }
+
+    operator lua_State*() const { return L_; }
+
+private:
+    lua_State* L_;
+};
+
+#endif
@@ -0,0 +1,88 @@
+// Lazy ranges over Lua values: sequences, tables, closure and coroutine
+// generators, including values of the wrong type and generators that fail.
+
+#include "lua_test.hpp"
+#include "lua_ranges.hpp"
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+static const char* kScript = R"(
+    function scores() return {0.5, 0.95, 0.25} end
+    function units() return {orc = 30, elf = 20, dwarf = 40} end
+    function mixed() return {1, "two", 3} end
+    function counter(n) local i = 0 return function() i = i + 1 if i <= n then return i end end end
+    function ids(n) return coroutine.create(function() for i = 1, n do coroutine.yield(i * 10) end return "done" end) end
+    function failing() return coroutine.create(function() coroutine.yield(1) error("generator failed") end) end
+    function self() local t = {} t.self = t return t end
+)";
+
+static void testSequence() {
+    LuaTestState L(kScript);
+    auto scores = CallLuaFunction<LuaSequenceRange<double>>(L, "scores");
+    CHECK(scores.size() == 3);
+    CHECK(scores.at(1) == 0.95);
+    auto it = std::ranges::find_if(scores, [](double s) { return s > 0.9; });
+    CHECK(*it == 0.95);
+    CHECK_THROWS(scores.at(3), std::out_of_range);
+
+    auto mixed = CallLuaFunction<LuaSequenceRange<int>>(L, "mixed");
+    CHECK(mixed.at(0) == 1 && mixed.at(2) == 3);
+    CHECK_THROWS(mixed.at(1), std::runtime_error);
+    CHECK_THROWS(CallLuaFunction<LuaSequenceRange<int>>(L, "counter", 1), std::runtime_error);
+    CHECK(lua_gettop(L) == 0);
+}
+
+static void testTable() {
+    LuaTestState L(kScript);
+    std::map<std::string, int> seen;
+    for (const auto& [name, hp] : CallLuaFunction<LuaTableRange<std::string, int>>(L, "units")) {
+        seen[name] = hp;
+    }
+    CHECK((seen == std::map<std::string, int>{{"dwarf", 40}, {"elf", 20}, {"orc", 30}}));
+
+    // A table holding itself is visited once, not followed
+    int entries = 0;
+    for (const auto& entry : CallLuaFunction<LuaTableRange<std::string, LuaSequenceRange<int>>>(L, "self")) {
+        (void)entry;
+        ++entries;
+    }
+    CHECK(entries == 1);
+
+    auto bad = CallLuaFunction<LuaTableRange<std::string, std::string>>(L, "units");
+    CHECK_THROWS(bad.begin(), std::runtime_error);
+    CHECK(lua_gettop(L) == 0);
+}
+
+static void testGenerators() {
+    LuaTestState L(kScript);
+    std::vector<int> values;
+    for (int value : CallLuaFunction<LuaGenerator<int>>(L, "counter", 4)) {
+        values.push_back(value);
+    }
+    CHECK((values == std::vector<int>{1, 2, 3, 4}));
+
+    values.clear();
+    for (int value : CallLuaFunction<LuaGenerator<int>>(L, "ids", 3)) {
+        values.push_back(value);
+    }
+    CHECK((values == std::vector<int>{10, 20, 30}));
+
+    auto failing = CallLuaFunction<LuaGenerator<int>>(L, "failing");
+    auto it = failing.begin();
+    CHECK(*it == 1);
+    CHECK_THROWS(++it, std::runtime_error);
+    CHECK(it == std::default_sentinel);
+
+    CHECK_THROWS(CallLuaFunction<LuaGenerator<int>>(L, "scores"), std::runtime_error);
+    CHECK(lua_gettop(L) == 0);
+}
+
+int main() {
+    testSequence();
+    testTable();
+    testGenerators();
+    return LuaTestResult();
+}
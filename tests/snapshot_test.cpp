@@ -0,0 +1,106 @@
+// LuaSnapshot: copies between states with shared and cyclic tables, saved
+// and mapped snapshots, and malformed input that must throw cleanly.
+
+#include "lua_test.hpp"
+#include "lua_snapshot.hpp"
+
+#include <filesystem>
+#include <string>
+
+static const char* kExporter = R"(
+    function export()
+        local shared = {x = 1}
+        local t = {1, -2, 3.5, "hello", "hello", true, false,
+                   a = shared, b = shared, big = math.mininteger,
+                   s = string.rep("z", 1000), nested = {{1}, {2, {3}}}}
+        t.self = t
+        return t
+    end
+    function withFunction() return {f = print} end
+    function deep(n) local t = {} for i = 1, n do t = {t} end return t end
+)";
+
+static const char* kImporter = R"(
+    function check(t)
+        return t[1] == 1 and t[2] == -2 and t[3] == 3.5 and t[4] == "hello" and t[5] == "hello"
+           and t[6] == true and t[7] == false
+           and t.a == t.b and t.a.x == 1
+           and t.self == t
+           and t.big == math.mininteger and math.type(t.big) == "integer"
+           and #t.s == 1000 and t.nested[2][2][1] == 3
+    end
+    function echo(v) return v end
+)";
+
+static void testRoundTrip() {
+    LuaTestState from(kExporter);
+    LuaTestState to(kImporter);
+    LuaSnapshot snapshot = CallLuaFunction<LuaSnapshot>(from, "export");
+    CHECK(snapshot.size() > 0);
+    CHECK(CallLuaFunction<bool>(to, "check", snapshot));
+    CHECK(CallLuaFunction<bool>(to, "check", LuaSnapshot::fromBytes(std::string(snapshot.bytes()))));
+
+    // Through Lua and back: the copy captures the same graph again
+    LuaSnapshot again = CallLuaFunction<LuaSnapshot>(to, "echo", snapshot);
+    CHECK(CallLuaFunction<bool>(to, "check", again));
+
+    LuaSnapshot empty;
+    empty.push(to);
+    CHECK(lua_isnil(to, -1));
+    lua_pop(to, 1);
+    CHECK(lua_gettop(from) == 0 && lua_gettop(to) == 0);
+}
+
+static void testSaveAndMap() {
+    LuaTestState from(kExporter);
+    LuaTestState to(kImporter);
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "lua_bindings_snapshot_test.lsnp";
+    LuaSnapshot snapshot = CallLuaFunction<LuaSnapshot>(from, "export");
+    CHECK(snapshot.save(path));
+    {
+        LuaSnapshot mapped = LuaSnapshot::map(path);
+        CHECK(mapped.size() == snapshot.size());
+        CHECK(CallLuaFunction<bool>(to, "check", mapped));
+    }
+    std::filesystem::remove(path);
+}
+
+static void testMalformedInput() {
+    LuaTestState from(kExporter);
+    LuaTestState to(kImporter);
+    LuaSnapshot snapshot = CallLuaFunction<LuaSnapshot>(from, "export");
+    std::string bytes(snapshot.bytes());
+
+    // Every truncation throws and leaves the stack as it was
+    for (size_t n = 1; n < bytes.size(); ++n) {
+        CHECK_THROWS(LuaSnapshot::push(to, std::string_view(bytes).substr(0, n)), std::runtime_error);
+        CHECK(lua_gettop(to) == 0);
+    }
+
+    // Flipped bytes either decode to some value or throw, never crash
+    for (size_t i = 0; i < bytes.size(); ++i) {
+        std::string damaged = bytes;
+        damaged[i] ^= 0x5a;
+        try {
+            LuaSnapshot::push(to, damaged);
+            lua_pop(to, 1);
+        } catch (const std::runtime_error&) {
+        }
+        CHECK(lua_gettop(to) == 0);
+    }
+}
+
+static void testRejectedValues() {
+    LuaTestState from(kExporter);
+    CHECK_THROWS(CallLuaFunction<LuaSnapshot>(from, "withFunction"), std::runtime_error);
+    CHECK_THROWS(CallLuaFunction<LuaSnapshot>(from, "deep", 1000), std::runtime_error);
+    CHECK(lua_gettop(from) == 0);
+}
+
+int main() {
+    testRoundTrip();
+    testSaveAndMap();
+    testMalformedInput();
+    testRejectedValues();
+    return LuaTestResult();
+}
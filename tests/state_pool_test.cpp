@@ -0,0 +1,101 @@
+// LuaStatePool: results and errors through futures, owned copies of string
+// arguments, work spread over the workers, reloads, and construction
+// failures.
+
+#include "lua_test.hpp"
+#include "lua_state_pool.hpp"
+
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const char* kScript = R"(
+    function add(a, b) return a + b end
+    function concat(a, b) return a .. b end
+    function fail() error("task failed") end
+    function length(t) return #t end
+    function version() return 1 end
+)";
+
+static void testResults() {
+    LuaStatePool pool(4, kScript);
+    CHECK(pool.size() == 4);
+    std::vector<std::future<int>> results;
+    for (int i = 0; i < 2000; ++i) {
+        results.push_back(pool.submit<int>("add", i, 1));
+    }
+    long long sum = 0;
+    for (auto& result : results) {
+        sum += result.get();
+    }
+    CHECK(sum == 2000LL * 2001 / 2);
+    CHECK(pool.submit<int>("length", std::vector<int>{1, 2, 3}).get() == 3);
+}
+
+static void testStringArgumentsAreCopied() {
+    LuaStatePool pool(2, kScript);
+    std::future<std::string> result;
+    {
+        std::string left = "left-";
+        char right[] = "right";
+        result = pool.submit<std::string>("concat", std::string_view(left), static_cast<const char*>(right));
+        left.assign("XXXXX");
+        right[0] = 'X';
+    }
+    CHECK(result.get() == "left-right");
+}
+
+static void testErrors() {
+    LuaStatePool pool(2, kScript);
+    std::future<void> failed = pool.submit<void>("fail");
+    CHECK_THROWS(failed.get(), std::runtime_error);
+    CHECK_THROWS(pool.submit<int>("missing").get(), std::runtime_error);
+    std::future<int> thrown = pool.execute([](lua_State*) -> int { throw std::logic_error("from execute"); });
+    CHECK_THROWS(thrown.get(), std::logic_error);
+    CHECK(pool.submit<int>("add", 1, 2).get() == 3);  // Workers survive failed tasks
+}
+
+static void testSpreadOverWorkers() {
+    LuaStatePool pool(4, kScript);
+    std::mutex mutex;
+    std::set<lua_State*> states;
+    std::vector<std::future<void>> done;
+    for (int i = 0; i < 200; ++i) {
+        done.push_back(pool.execute([&](lua_State* L) {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            std::lock_guard<std::mutex> lock(mutex);
+            states.insert(L);
+        }));
+    }
+    for (auto& d : done) {
+        d.get();
+    }
+    CHECK(states.size() > 1);
+}
+
+static void testReload() {
+    LuaStatePool pool(3, kScript);
+    CHECK(pool.submit<int>("version").get() == 1);
+    pool.reloader().reload("function version() return 2 end", "=v2");
+    for (int i = 0; i < 30; ++i) {
+        CHECK(pool.submit<int>("version").get() == 2);
+    }
+    CHECK(pool.submit<int>("add", 2, 2).get() == 4);  // Functions the new version lacks stay
+}
+
+static void testConstructionFailures() {
+    CHECK_THROWS(LuaStatePool(0, kScript), std::invalid_argument);
+    CHECK_THROWS(LuaStatePool(2, "this is not lua"), std::runtime_error);
+    CHECK_THROWS(LuaStatePool(2, kScript, [](lua_State*) { throw std::runtime_error("setup failed"); }), std::runtime_error);
+}
+
+int main() {
+    testResults();
+    testStringArgumentsAreCopied();
+    testErrors();
+    testSpreadOverWorkers();
+    testReload();
+    testConstructionFailures();
+    return LuaTestResult();
+}
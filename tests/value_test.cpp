@@ -0,0 +1,89 @@
+// LuaValue and LuaDocument: round trips in both directions, shared and
+// cyclic tables, and the errors for values a document cannot hold.
+
+#include "lua_test.hpp"
+#include "lua_value.hpp"
+
+#include <string>
+#include <unordered_set>
+
+static const char* kScript = R"(
+    function config()
+        return {
+            server = {port = 8080, host = "a-very-long-hostname.example"},
+            tags = {"x", "y", 3.5},
+            [1.5] = true,
+            flag = false,
+        }
+    end
+    function echo(v) return v end
+    function count(t) local n = 0 for _ in pairs(t) do n = n + 1 end return n, #t end
+    function shared() local s = {k = 1} return {a = s, b = s, c = {s}} end
+    function cyclic() local t = {} t.self = t return t end
+    function deep(n) local t = {} for i = 1, n do t = {t} end return t end
+    function withFunction() return {f = print} end
+    function check(d) return d.server.port == 8080 and d.tags[2] == "y" and d[1.5] == true end
+)";
+
+static void testReadRoundTrip() {
+    LuaTestState L(kScript);
+    LuaDocument doc = CallLuaFunction<LuaDocument>(L, "config");
+    CHECK(doc["server"]["port"].asInteger() == 8080);
+    CHECK(doc["server"]["host"].asString() == "a-very-long-hostname.example");
+    CHECK(doc["tags"].asTable().size() == 3);
+    CHECK(doc["tags"][1].asString() == "x");
+    CHECK(doc["tags"][3].asNumber() == 3.5);
+    CHECK(doc[1.5].asBoolean());
+    CHECK(!doc["flag"].asBoolean());
+    CHECK(doc["missing"].isNil());
+
+    // Back to Lua and read again
+    CHECK(CallLuaFunction<bool>(L, "check", doc));
+    LuaDocument back = CallLuaFunction<LuaDocument>(L, "echo", doc);
+    CHECK(back["server"]["host"].asString() == "a-very-long-hostname.example");
+    auto [entries, length] = CallLuaFunction<int, int>(L, "count", doc["tags"]);
+    CHECK(entries == 3 && length == 3);
+    CHECK(lua_gettop(L) == 0);
+}
+
+static void testScalarValues() {
+    LuaTestState L(kScript);
+    CHECK(CallLuaFunction<LuaDocument>(L, "echo", "short").root().asString() == "short");
+    CHECK(CallLuaFunction<LuaDocument>(L, "echo", 42).root().asInteger() == 42);
+    CHECK(CallLuaFunction<LuaDocument>(L, "echo", 0.25).root().asNumber() == 0.25);
+    CHECK(CallLuaFunction<LuaDocument>(L, "echo").root().isNil());
+    std::string longText(100, 'z');
+    CHECK(CallLuaFunction<std::string>(L, "echo", LuaValue(longText)) == longText);
+
+    // Raw equality: 1 == 1.0, and nil is an ordinary key
+    CHECK(LuaValue(1) == LuaValue(1.0));
+    CHECK(LuaValue(1).hash() == LuaValue(1.0).hash());
+    std::unordered_set<LuaValue> keys{LuaValue(), LuaValue(2), LuaValue("two")};
+    CHECK(keys.count(LuaValue(2.0)) == 1 && keys.count(LuaValue()) == 1);
+}
+
+static void testSharedTables() {
+    LuaTestState L(kScript);
+    LuaDocument doc = CallLuaFunction<LuaDocument>(L, "shared");
+    CHECK(doc["b"]["k"].asInteger() == 1);
+    CHECK(&doc["a"].asTable() == &doc["b"].asTable());
+    CHECK(&doc["c"][1].asTable() == &doc["a"].asTable());
+}
+
+static void testRejectedValues() {
+    LuaTestState L(kScript);
+    CHECK_THROWS(CallLuaFunction<LuaDocument>(L, "cyclic"), std::runtime_error);
+    CHECK_THROWS(CallLuaFunction<LuaDocument>(L, "deep", LuaDocument::kMaxDepth + 10), std::runtime_error);
+    CHECK_THROWS(CallLuaFunction<LuaDocument>(L, "withFunction"), std::runtime_error);
+    CHECK(lua_gettop(L) == 0);
+    LuaDocument nested = CallLuaFunction<LuaDocument>(L, "deep", LuaDocument::kMaxDepth - 1);
+    CHECK(nested.root().isTable());
+}
+
+int main() {
+    testReadRoundTrip();
+    testScalarValues();
+    testSharedTables();
+    testRejectedValues();
+    return LuaTestResult();
+}
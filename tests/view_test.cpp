@@ -0,0 +1,113 @@
+// LuaView and LuaBuffer: reads and writes through the proxies, pairs()
+// while the container changes, detaching after the call, and metamethods
+// called on the wrong values.
+
+#include "lua_test.hpp"
+#include "lua_view.hpp"
+
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+static const char* kScript = R"(
+    function sum(v) local s = 0 for i = 1, #v do s = s + v[i] end return s end
+    function scale(v, k) for i = 1, #v do v[i] = v[i] * k end end
+    function total(v) local s = 0 for _, x in pairs(v) do s = s + x end return s end
+    function edit(v) v.a = 10 v.b = nil v.c = 3 return v.a end
+    function keep(v) kept = v end
+    function readKept() return #kept, kept[1] end
+    function writeKept() kept[1] = 5 end
+    function grow(v)
+        local seen = 0
+        for k in pairs(v) do
+            seen = seen + 1
+            if seen < 200 then v["new" .. seen] = seen end
+            v[k] = nil
+        end
+        return seen
+    end
+    function eraseNext(v)
+        for k in pairs(v) do
+            for k2 in pairs(v) do if k2 ~= k then v[k2] = nil break end end
+        end
+    end
+    function attack(v)
+        local mt = debug.getmetatable(v)
+        for _, name in ipairs{"__len", "__index", "__newindex"} do
+            if mt[name] and (pcall(mt[name], 5, 1, 2) or pcall(mt[name], io.stdout, 1, 2)) then return false end
+        end
+        return getmetatable(v) ~= mt
+    end
+    function cursorAfterGc(v)
+        local step = pairs(v)
+        local _, cursor = debug.getupvalue(step, 1)
+        local gc = debug.getmetatable(cursor).__gc
+        if pcall(gc, nil) or pcall(gc, io.stdout) then return false end
+        gc(cursor)
+        gc(cursor)
+        return not pcall(step, v, nil)
+    end
+)";
+
+static void testBuffer() {
+    LuaTestState L(kScript);
+    std::vector<double> samples{1, 2, 3};
+    CHECK(CallLuaFunction<double>(L, "sum", LuaBuffer(samples)) == 6);
+    CallLuaFunction<void>(L, "scale", LuaBuffer(samples), 2.0);
+    CHECK(samples[2] == 6);
+    const std::vector<int> fixed{4, 5};
+    CHECK(CallLuaFunction<int>(L, "sum", LuaBuffer(fixed)) == 9);
+    CHECK_THROWS(CallLuaFunction<void>(L, "scale", LuaBuffer(fixed), 2), std::runtime_error);
+    CHECK(CallLuaFunction<bool>(L, "attack", LuaBuffer(samples)));
+}
+
+static void testMapView() {
+    LuaTestState L(kScript);
+    std::map<std::string, int> map{{"a", 1}, {"b", 2}};
+    CHECK(CallLuaFunction<int>(L, "total", LuaView(std::as_const(map))) == 3);
+    CHECK(CallLuaFunction<int>(L, "edit", LuaView(map)) == 10);
+    CHECK((map == std::map<std::string, int>{{"a", 10}, {"c", 3}}));
+    std::vector<int> list{1, 2, 3};
+    CHECK(CallLuaFunction<int>(L, "sum", LuaView(list)) == 6);
+    CHECK(CallLuaFunction<bool>(L, "attack", LuaView(map)));
+}
+
+static void testChangesDuringPairs() {
+    LuaTestState L(kScript);
+    std::unordered_map<std::string, int> grown;
+    for (int i = 0; i < 50; ++i) {
+        grown["k" + std::to_string(i)] = i;
+    }
+    CHECK(CallLuaFunction<int>(L, "grow", LuaView(grown)) > 0);
+    std::unordered_map<std::string, int> erased{{"a", 1}, {"b", 2}, {"c", 3}};
+    CHECK_THROWS(CallLuaFunction<void>(L, "eraseNext", LuaView(erased)), std::runtime_error);
+    std::map<std::string, int> cursor{{"a", 1}, {"b", 2}};
+    CHECK(CallLuaFunction<bool>(L, "cursorAfterGc", LuaView(cursor)));
+}
+
+static void testDetachedAfterCall() {
+    LuaTestState L(kScript);
+    {
+        std::vector<double> samples{1, 2};
+        CallLuaFunction<void>(L, "keep", LuaBuffer(samples));
+    }
+    auto [length, first] = CallLuaFunction<int, std::optional<double>>(L, "readKept");
+    CHECK(length == 0 && !first);
+    CHECK_THROWS(CallLuaFunction<void>(L, "writeKept"), std::runtime_error);
+    {
+        std::vector<int> list{1, 2};
+        CallLuaFunction<void>(L, "keep", LuaView(list));
+    }
+    CHECK(CallLuaFunction<int>(L, "readKept") == 0);
+    CHECK_THROWS(CallLuaFunction<void>(L, "writeKept"), std::runtime_error);
+    CHECK(lua_gettop(L) == 0);
+}
+
+int main() {
+    testBuffer();
+    testMapView();
+    testChangesDuringPairs();
+    testDetachedAfterCall();
+    return LuaTestResult();
+}